@@ -17,15 +17,38 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <math.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#endif
 #ifdef _WIN32
 #include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
 #endif
 
 #include "simplexnoise.h"
+#include "worldpack.h"
 
 char version[] = "0.9";
 
@@ -34,6 +57,29 @@ char help[] = "\ncsworldgen %s\n\noutput options\n\
 -o     output directory - no default, mandatory\n\
 -pgm   write pgm files - default: 0\n\
 -info  write info file - default: 1\n\
+-region  comma separated region numbers N of the Monde_N files to write,\n\
+       the other region files are left alone and their caves are kept in\n\
+       Monde_Volume; trees, doodads and the info file are written for the\n\
+       whole world (not with -pack) - default: all\n\
+-pack  write one packed container file named by -o instead of a directory\n\
+       (pgm files are not included) - default: 0\n\
+-rle   run length code the regions in packed containers - default: 0\n\
+-inc   incremental writing: files whose content did not change are not\n\
+       rewritten, their hashes are kept in csworldgen.hashes in the output\n\
+       directory (not with -pack) - default: 0\n\
+-packdir  pack an existing world directory into the container -o and exit\n\
+-unpack   unpack a container into the world directory -o and exit\n\
+\n\
+input options\n\
+\n\
+-load  world directory or packed container to load, its terrain is kept and\n\
+       only trees and crystals are placed again; parameters are taken from\n\
+       its info file unless given on the command line - default: none\n\
+-g     noise graph file, lines 'island = ...', 'height = ...' and\n\
+       'trees = ...' replace the built-in field - default: none\n\
+       nodes (postfix): noise octaves persistence octavescale scale offset,\n\
+       falloff, const v, add, sub, mul, div, min, max, invert, abs,\n\
+       pow e, clamp lo hi, threshold level\n\
 \n\
 noise function parameters for island outline\n\
 \n\
@@ -96,27 +142,172 @@ crystal distribution parameters\n\
 -cs    allowed slope - default: 0.13\n\
 -csd   distance of start point - default: 8.0\n\
 \n\
+cave parameters (3d noise inside the land columns)\n\
+\n\
+-v     seed - default: random\n\
+-vs    scale - default: 64.0\n\
+-vo    number of octaves - default: 2\n\
+-vos   scale factor for each octave - default: 0.5\n\
+-vop   persistence factor for each octave - default: 0.5\n\
+-vt    noise value above which blocks are carved out, 0..1 - default: 1.0 (off)\n\
+-vm    solid blocks kept below the top and above the bottom - default: 2\n\
+       carved blocks go to Monde_Volume, not with -pack\n\
+\n\
+thermal erosion parameters\n\
+\n\
+-e     number of iterations - default: 0 (off)\n\
+-et    talus slope that stays stable - default: 0.2\n\
+-eb    time budget in ms - default: 0 (unlimited)\n\
+\n\
+processing options\n\
+\n\
+-j     number of threads - default: number of cores\n\
+-tiled run island, top layer and edge rounding per cache sized tile - default: 0\n\
+-ae    error bound for adaptive sampling of island and height noise\n\
+       (in units of the 0..1 noise value, island outline stays exact)\n\
+       - default: 0.0 (off)\n\
+-aq    print adaptive sampling quality report against full evaluation - default: 0\n\
+-lc    keep the raw noise of every island and height octave per cell, so\n\
+       sweep values and reruns that only change -iop -ie -iz -id -hop -hb\n\
+       -ht -he -hi -hf just add up the kept octaves (not with -ae,\n\
+       noise graphs, -batch, -queue or -search) - default: 0\n\
+-lcdir directory the octave layers are kept in between runs, implies -lc\n\
+       - default: none\n\
+-hp    request huge pages for the world buffers (linux) - default: 0\n\
+-mem   print memory use of the world - default: 0\n\
+-layoutbench  time the plane layouts (rows, 32 x 32 tiles, Morton order) on\n\
+       the bottom smoothing and crystal disk kernels for maps of 1024 and\n\
+       4096 cells per side, write <-o>/layouts.txt and exit; the layout of\n\
+       the world is chosen when compiling (PLANE_LAYOUT) - default: 0\n\
+-bench corpus file of parameter presets (see corpus.txt), each one is\n\
+       generated as 1, 2, 4 .. -benchj worlds at once (processes on linux,\n\
+       each world single threaded) to measure throughput scaling; stage\n\
+       times, output hashes and the tables go to <-o>/bench.txt, then exit\n\
+       - default: none\n\
+-benchj  most worlds at once for -bench - default: -j\n\
+-benchn  rounds per preset and world count, the fastest counts - default: 3\n\
+-benchbase  bench.txt of an earlier run to compare times and outputs with\n\
+       - default: none\n\
+-deadline  time in ms to generate and write a world in, stages with open\n\
+       ended loops stop early and the info file lists them; every world of\n\
+       -batch and -search and every -sweep value (after the shared stages)\n\
+       has its own budget - default: 0 (off)\n\
+-perf  print time, IPC, cache and branch misses of each stage (of each kernel\n\
+       with -layoutbench), counters need linux perf events - default: 0\n\
+-sweep vary one parameter, name=first:last:step (e.g. td=0.4:0.8:0.05);\n\
+       stages before the first one using it run once, -o gets one\n\
+       directory per value and the summary sweep.txt - default: none\n\
+\n\
+batches and seed search\n\
+\n\
+-batch number of worlds, world k adds k to every seed; -o gets world_<k>\n\
+       directories and the summary batch.txt, files are written while\n\
+       the later stages run - default: 0 (off)\n\
+-queue worlds per chunk of a batch shared by several processes, also on\n\
+       other hosts: every worker started with the same -o claims chunks\n\
+       through lease files in <-o>/queue, the first one fixes the\n\
+       parameters for all of them (queue/job.txt), each chunk gets a\n\
+       manifest queue/chunk_<n>.txt and the summary goes to queue.txt\n\
+       - default: 0 (off)\n\
+-ql    seconds after which the lease of a chunk that was not renewed is\n\
+       taken over by another worker, hosts need clocks within that\n\
+       - default: 300\n\
+-search number of candidates, candidate k adds k to every seed; -o gets\n\
+       the best accepted worlds and the summary search.txt - default: 0 (off)\n\
+-sk    number of accepted worlds to write - default: 1\n\
+-sl    accepted land area as fraction of the map, min:max; worlds closest\n\
+       to the middle rank first - default: 0:1\n\
+-sm    cells between land and the map border - default: 1\n\
+       accepted worlds also need all trees and crystals and a valid start point\n\
+\n\
 \n\
 \n\
 example call: csworldgen -o OutDir -i 5 -h 3 -ht 224.0 -t 7\n\
 everything but output directory is optional\n";
 
-unsigned char top[1024][1024];
-unsigned char bottom[1024][1024];
-unsigned char material[1024][1024];
-unsigned char fraction[1024][1024];
-unsigned char temp[1024][1024];
-unsigned int  trees[32768];
-unsigned int  crystals[512];
+// plane layout
+//
+// The stages address the planes of the map only through cell(x, y), so their
+// layout is chosen at compile time with PLANE_LAYOUT: 0 rows (default), 1 tiles
+// of 32 x 32 cells (tiles and the cells in them in row order), 2 Morton (Z)
+// order. Files and pgm images are written in row order for every layout. The
+// blocked layouts wrap coordinates outside the map to the other side, rows read
+// the neighboring row or plane there, so worlds whose land reaches the map
+// border can differ at that border.
+#ifndef PLANE_LAYOUT
+#define PLANE_LAYOUT 0
+#endif
+
+// spreads the (up to 16) bits of v to the even bits
+static inline int mortonBits(int v)
+{
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+static inline int cell(int x, int y)
+{
+	#if PLANE_LAYOUT == 1
+	x &= 1023;
+	y &= 1023;
+	return ((y >> 5) << 15) + ((x >> 5) << 10) + ((y & 31) << 5) + (x & 31);
+	#elif PLANE_LAYOUT == 2
+	return mortonBits(x & 1023) | (mortonBits(y & 1023) << 1);
+	#else
+	return y * 1024 + x;
+	#endif
+}
+
+// stride of a window over the whole map, 0 makes it address the planes through cell()
+#if PLANE_LAYOUT == 0
+#define MAP_STRIDE 1024
+#else
+#define MAP_STRIDE 0
+#endif
+
+// planes of the world currently worked on, they point into its arena (see bindWorld),
+// one world per process
+unsigned char* top;
+unsigned char* bottom;
+unsigned char* material;
+unsigned char* fraction;
+unsigned char* temp;
+short        (*erosion)[1024 * 1024];
+double        (*falloffField)[513][513];
+unsigned int* trees;
+unsigned int* crystals;
 unsigned int  startPoint;
+int           startPointValid;
 
 #define GRASS 2
 #define DIRT 4
 
 #define MIN(a, b) ((a < b) ? (a) : (b))
+#define MAX(a, b) ((a > b) ? (a) : (b))
 #define LIMIT(a, min, max) ((a < min) ? (min) : ((a > max) ? (max) : (a)))
 
 char   outputDir[512] = "";
+char   graphFile[512] = "";
+char   packSource[512] = "";
+char   unpackSource[512] = "";
+char   loadSource[512] = "";
+char   sweepSpec[512] = "";
+char   layerDir[512] = "";
+char   benchCorpus[512] = "";
+char   benchBase[512] = "";
+
+int    batchCount = 0;
+int    queueSize = 0;
+int    queueTimeout = 300;
+
+int    searchCount = 0;
+int    searchKeep = 1;
+double searchLandMin = 0.0;
+double searchLandMax = 1.0;
+int    searchMargin = 1;
 
 int    islandSeed;
 double islandScale = 8.0;
@@ -160,8 +351,38 @@ int    crystalDistance = 128;
 double crystalMaxSlope = 0.13;
 double crystalStartPointDistance = 8.0;
 
+int    volumeSeed;
+double volumeScale = 64.0;
+int    volumeOctaves = 2;
+double volumeOctaveScale = 0.5;
+double volumeOctavePersistence = 0.5;
+double volumeThreshold = 1.0;
+int    volumeMargin = 2;
+
+int    erosionIterations = 0;
+double erosionTalus = 0.2;
+int    erosionBudget = 0;
+
+int    threads = 1;
+int    tiled = 0;
+double adaptiveBound = 0.0;
+int    adaptiveQuality = 0;
+int    layerCache = 0;
+
+int    hugePages = 0;
+int    memoryReport = 0;
+int    layoutBench = 0;
+int    benchThreads = 0;
+int    benchRepeat = 3;
+int    perfOut = 0;
+int    deadlineMs = 0;
+
+int    packOut = 0;
+int    packRle = 0;
+
 int    pgmOut = 0;
 int    infoOut = 1;
+int    incremental = 0;
 
 
 void checkHelp(int argc, char** argv)
@@ -189,15 +410,47 @@ void initialize()
 	treeSeed = rand() % 0x8000;
 	treeSeedPos = rand() % 0x8000;
 	crystalSeed = rand() % 0x8000;
+	volumeSeed = rand() % 0x8000;
+	threads = std::thread::hardware_concurrency();
+	if(threads < 1) threads = 1;
 }
 
-void readParameters(int argc, char** argv)
+// with -region only the listed regions are carved and written
+unsigned int regionMask = 0;
+
+int regionWanted(int i)
+{
+	return !regionMask || ((regionMask >> i) & 1);
+}
+
+void parseRegions(char* list)
+{
+	for(char* token = strtok(list, ","); token; token = strtok(0, ","))
+	{
+		int i = atoi(token);
+		if(i < 0 || i > 27 || i % 8 > 3)
+		{
+			printf("error in -region: there is no Monde_%s\n", token);
+			exit(EXIT_FAILURE);
+		}
+		regionMask |= 1u << i;
+	}
+}
+
+void parseParameters(int argc, char** argv)
 {
 	for(int i = 1; i < argc; ++i)
 	{
 		if(!strcmp(argv[i], "-o")) strcpy(outputDir, argv[++i]);
+		else if(!strcmp(argv[i], "-load")) strcpy(loadSource, argv[++i]);
 		else if(!strcmp(argv[i], "-pgm")) pgmOut = atoi(argv[++i]);
 		else if(!strcmp(argv[i], "-info")) infoOut = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-g")) strcpy(graphFile, argv[++i]);
+		else if(!strcmp(argv[i], "-pack")) packOut = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-rle")) packRle = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-inc")) incremental = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-packdir")) strcpy(packSource, argv[++i]);
+		else if(!strcmp(argv[i], "-unpack")) strcpy(unpackSource, argv[++i]);
 
 		else if(!strcmp(argv[i], "-i")) islandSeed = atoi(argv[++i]);
 		else if(!strcmp(argv[i], "-is")) islandScale = atof(argv[++i]);
@@ -244,417 +497,4338 @@ void readParameters(int argc, char** argv)
 		else if(!strcmp(argv[i], "-cs")) crystalMaxSlope = atof(argv[++i]);
 		else if(!strcmp(argv[i], "-csd")) crystalStartPointDistance = atof(argv[++i]);
 
+		else if(!strcmp(argv[i], "-v")) volumeSeed = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-vs")) volumeScale = atof(argv[++i]);
+		else if(!strcmp(argv[i], "-vo")) volumeOctaves = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-vos")) volumeOctaveScale = atof(argv[++i]);
+		else if(!strcmp(argv[i], "-vop")) volumeOctavePersistence = atof(argv[++i]);
+		else if(!strcmp(argv[i], "-vt")) volumeThreshold = atof(argv[++i]);
+		else if(!strcmp(argv[i], "-vm")) volumeMargin = atoi(argv[++i]);
+
+		else if(!strcmp(argv[i], "-e")) erosionIterations = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-et")) erosionTalus = atof(argv[++i]);
+		else if(!strcmp(argv[i], "-eb")) erosionBudget = atoi(argv[++i]);
+
+		else if(!strcmp(argv[i], "-j")) threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-tiled")) tiled = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-ae")) adaptiveBound = atof(argv[++i]);
+		else if(!strcmp(argv[i], "-aq")) adaptiveQuality = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-lc")) layerCache = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-lcdir")) strcpy(layerDir, argv[++i]);
+		else if(!strcmp(argv[i], "-hp")) hugePages = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-mem")) memoryReport = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-layoutbench")) layoutBench = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-bench")) strcpy(benchCorpus, argv[++i]);
+		else if(!strcmp(argv[i], "-benchj")) benchThreads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-benchn")) benchRepeat = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-benchbase")) strcpy(benchBase, argv[++i]);
+		else if(!strcmp(argv[i], "-perf")) perfOut = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-deadline")) deadlineMs = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-region")) parseRegions(argv[++i]);
+		else if(!strcmp(argv[i], "-sweep")) strcpy(sweepSpec, argv[++i]);
+		else if(!strcmp(argv[i], "-batch")) batchCount = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-queue")) queueSize = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-ql")) queueTimeout = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-search")) searchCount = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-sk")) searchKeep = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-sl"))
+		{
+			if(sscanf(argv[++i], "%lf:%lf", &searchLandMin, &searchLandMax) != 2)
+			{
+				printf("error in -sl %s: expected min:max\n", argv[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
+		else if(!strcmp(argv[i], "-sm")) searchMargin = atoi(argv[++i]);
+
 		else
 		{
 			printf("error at or before commandline parameter %d: %s\n", i, argv[i]);
 			exit(EXIT_FAILURE);
 		}
 	}
+}
+
+void readParameters(int argc, char** argv)
+{
+	parseParameters(argc, argv);
 	if(!strcmp(outputDir, ""))
 	{
 		printf("output directory is mandatory and can't be empty.\n");
 		exit(EXIT_FAILURE);
 	}
+	if(threads < 1) threads = 1;
+	if(strcmp(layerDir, "")) layerCache = 1;
+	if(treeNumber > 32768 || crystalNumber > 512)
+	{
+		printf("at most 32768 trees (-tn) and 512 crystals (-cn)\n");
+		exit(EXIT_FAILURE);
+	}
+	if(crystalGrassRadius < 2 || crystalGrassRadius > 510)
+	{
+		printf("crystal radius (-cr) has to be between 2 and 510\n");
+		exit(EXIT_FAILURE);
+	}
 }
 
-double falloff(int x, int y)
+// pipeline stages, in order; a stage only depends on the parameters of itself
+// and the stages before it
+
+#define STAGE_ISLAND 0
+#define STAGE_TOP 1      // top layer and edge rounding
+#define STAGE_EROSION 2
+#define STAGE_BOTTOM 3
+#define STAGE_VOLUME 4
+#define STAGE_TREES 5
+#define STAGE_CRYSTALS 6
+#define STAGE_COUNT 7
+
+// deadline
+//
+// With -deadline every world has to be written within the given time. Each
+// stage may use its weight's share of the time that is left when it starts
+// (unused time carries over to the later stages). The stages with open ended
+// loops stop when their share is used up and keep what they have so far:
+// erosion does fewer iterations, the bottom fewer smoothing passes (every pass
+// leaves a valid bottom), caves are carved in part of the land boxes, fewer trees
+// are planted and fewer crystals grown. The stages that stopped early are
+// listed in the info file. Island outline and top layer are bounded and run in full.
+
+#define DEADLINE_WRITE STAGE_COUNT
+
+const double stageWeight[STAGE_COUNT + 1] = {60, 25, 60, 200, 400, 10, 10, 10};
+
+unsigned int degradedStages;
+std::chrono::steady_clock::time_point worldDeadline;
+std::chrono::steady_clock::time_point stageDeadline;
+
+// a world starts, its whole budget is ahead
+void deadlineStart()
+{
+	degradedStages = 0;
+	worldDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadlineMs);
+}
+
+void deadlineStage(int stage)
+{
+	if(!deadlineMs) return;
+	double weights = 0;
+	for(int s = stage; s <= DEADLINE_WRITE; ++s) weights += stageWeight[s];
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	stageDeadline = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>((worldDeadline - now) * (stageWeight[stage] / weights));
+}
+
+int pastDeadline()
+{
+	return deadlineMs && std::chrono::steady_clock::now() >= stageDeadline;
+}
+
+void degrade(int stage)
+{
+	degradedStages |= 1u << stage;
+}
+
+// radial falloff of the island
+double falloffExact(int x, int y)
 {
 	double fx = (x - 512.0) / 512.0;
 	double fy = (y - 512.0) / 512.0;
-	double f = ((islandSize - islandEdge) - sqrt(fx * fx + fy * fy)) / islandEdge;
-	f = pow(f, 3.0) + 1.0;
-	f = LIMIT(f, 0.0, 1.0);
-	return f;
+	double r = sqrt(fx * fx + fy * fy);
+	double f = ((islandSize - islandEdge) - r) / islandEdge;
+	double v = pow(f, 3.0) + 1.0;
+	return LIMIT(v, 0.0, 1.0);
 }
 
-void generateIsland()
+// The falloff only depends on the distance to the center, so the field holds
+// the values for offsets 0..512 in x and y (see prepareFalloff); the offsets
+// are exact in both directions, so the mirrored cells get the same bits.
+double falloff(int x, int y)
 {
-	printf("generating island outline: ");
-	init_noise(islandSeed);
-	for(int y = 0; y < 1024; ++y)
-	{
-		for(int x = 0; x < 1024; ++x)
-		{
-			double val = scaled_octave_noise_2d(islandOctaves, islandOctavePersistence, islandOctaveScale, 0.0, 1.0, (x - 512) * islandScale / 1024, (y - 512) * islandScale / 1024);
-			val *= falloff(x, y);
-			if(val > (1.0 - islandDensity)) material[y][x] = GRASS;
-		}
-	}
-	printf(" done.\n");
+	int ax = abs(x - 512);
+	int ay = abs(y - 512);
+	if(ax > 512 || ay > 512) return falloffExact(x, y);
+	return falloffField[0][ay][ax];
 }
 
-void generateTop()
+// noise graphs
+//
+// A field (island, height, trees) can be described by a postfix expression
+// instead of the built-in chain, e.g.
+//   island = noise 3 0.5 0.5 8.0 0.0 falloff mul
+// Lines of this form are read from the -g file (everything else is ignored, so
+// a csworldgen.info file can be passed back in). The expression is compiled
+// once into a list of ops with fixed stack slots and evaluated per row span,
+// so no intermediate full size planes are needed.
+
+#define GRAPH_MAX_OPS 64
+#define GRAPH_MAX_STACK 8
+
+enum
 {
-	printf("generating island top layer: ");
-	init_noise(heightSeed);
-	for(int y = 0; y < 1024; ++y)
+	OP_NOISE,     // octaves persistence octavescale scale offset -> noise in [0, 1]
+	OP_FALLOFF,   // -> island falloff
+	OP_CONST,     // value -> value
+	OP_ADD,       // a b -> a + b
+	OP_SUB,       // a b -> a - b
+	OP_MUL,       // a b -> a * b
+	OP_DIV,       // a b -> a / b
+	OP_MIN,       // a b -> min(a, b)
+	OP_MAX,       // a b -> max(a, b)
+	OP_INVERT,    // a -> 1 - a
+	OP_ABS,       // a -> |a|
+	OP_POW,       // a, exponent -> a ^ exponent
+	OP_CLAMP,     // a, lo hi -> a limited to [lo, hi]
+	OP_THRESHOLD, // a, level -> 1 if a > level else 0
+	OP_COUNT
+};
+
+struct GraphOpInfo
+{
+	const char* name;
+	int args;
+	int pops;
+};
+
+const GraphOpInfo graphOpInfo[OP_COUNT] =
+{
+	{"noise", 5, 0}, {"falloff", 0, 0}, {"const", 1, 0},
+	{"add", 0, 2}, {"sub", 0, 2}, {"mul", 0, 2}, {"div", 0, 2}, {"min", 0, 2}, {"max", 0, 2},
+	{"invert", 0, 1}, {"abs", 0, 1}, {"pow", 1, 1}, {"clamp", 2, 1}, {"threshold", 1, 1}
+};
+
+struct GraphOp
+{
+	int code;
+	int slot;
+	double arg[5];
+	octave_noise_2d_setup noise;
+};
+
+struct Graph
+{
+	int count;
+	GraphOp op[GRAPH_MAX_OPS];
+	char source[512];
+};
+
+Graph islandGraph;
+Graph heightGraph;
+Graph treeGraph;
+
+void compileGraph(Graph* graph, const char* name, const char* source)
+{
+	char buffer[512];
+	while(*source == ' ' || *source == '\t') ++source;
+	strncpy(buffer, source, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = 0;
+	strcpy(graph->source, buffer);
+	graph->count = 0;
+
+	int depth = 0;
+	for(char* token = strtok(buffer, " \t\r\n"); token; token = strtok(0, " \t\r\n"))
 	{
-		for(int x = 0; x < 1024; ++x)
+		int code;
+		for(code = 0; code < OP_COUNT && strcmp(token, graphOpInfo[code].name); ++code);
+		if(code == OP_COUNT)
+		{
+			printf("error in %s graph: unknown node %s\n", name, token);
+			exit(EXIT_FAILURE);
+		}
+		if(graph->count == GRAPH_MAX_OPS)
+		{
+			printf("error in %s graph: more than %d nodes\n", name, GRAPH_MAX_OPS);
+			exit(EXIT_FAILURE);
+		}
+		GraphOp* op = &graph->op[graph->count++];
+		op->code = code;
+		for(int i = 0; i < graphOpInfo[code].args; ++i)
 		{
-			double val = scaled_octave_noise_2d(heightOctaves, heightOctavePersistence, heightOctaveScale, 0.0, 1.0, (x - 512) * heightScale / 1024, (y - 512) * heightScale / 1024);
-			if(heightFalloff) val *= falloff(x, y);
-			if(heightValueInvert) val = 1.0f - val;
-			double height = pow(val, heightExponent);
-			height = heightBase + (heightTop - heightBase) * height;
-			if(material[y][x] != 0)
+			char* arg = strtok(0, " \t\r\n");
+			if(!arg)
 			{
-				top[y][x] = height;
-				fraction[y][x] = (height - top[y][x]) * 3.0 + 1.0;
-				bottom[y][x] = top[y][x] - bottomMinThick;
+				printf("error in %s graph: %s needs %d arguments\n", name, token, graphOpInfo[code].args);
+				exit(EXIT_FAILURE);
 			}
+			op->arg[i] = atof(arg);
+		}
+		if(depth < graphOpInfo[code].pops)
+		{
+			printf("error in %s graph: not enough inputs for %s\n", name, token);
+			exit(EXIT_FAILURE);
+		}
+		depth -= graphOpInfo[code].pops;
+		op->slot = depth++;
+		if(depth > GRAPH_MAX_STACK)
+		{
+			printf("error in %s graph: more than %d values pending\n", name, GRAPH_MAX_STACK);
+			exit(EXIT_FAILURE);
 		}
+		if(code == OP_NOISE) init_octave_noise_2d(&op->noise, op->arg[0], op->arg[1], op->arg[2]);
+	}
+	if(depth != 1)
+	{
+		printf("error in %s graph: expression leaves %d values instead of 1\n", name, depth);
+		exit(EXIT_FAILURE);
 	}
-	printf(" done.\n");
 }
 
-void erode()
+// compiles a line of a graph file (or of the graph section of an info file)
+void readGraphLine(char* line)
 {
-	for (int y = 1; y < 1023; ++y)
+	for(int n = strlen(line); n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r' || line[n - 1] == ' '); --n) line[n - 1] = 0;
+	if(!strncmp(line, "island =", 8)) compileGraph(&islandGraph, "island", line + 8);
+	else if(!strncmp(line, "height =", 8)) compileGraph(&heightGraph, "height", line + 8);
+	else if(!strncmp(line, "trees =", 7)) compileGraph(&treeGraph, "trees", line + 7);
+}
+
+void readGraphFile()
+{
+	FILE* in = fopen(graphFile, "r");
+	if(!in)
 	{
-		for (int x = 1; x < 1023; ++x)
-		{
-			if (  (material[y][x] == GRASS)
-			   && (material[y-1][x] == GRASS)
-			   && (material[y+1][x] == GRASS)
-			   && (material[y][x-1] == GRASS)
-			   && (material[y][x+1] == GRASS)
-			   )
-			{
-				temp[y][x] = 1;
-			}
-			else
-			{
-				temp[y][x] = 0;
-			}
-		}
+		printf("Could not open %s, aborting\n", graphFile);
+		exit(EXIT_FAILURE);
 	}
+	char line[512];
+	while(fgets(line, sizeof(line), in)) readGraphLine(line);
+	fclose(in);
 }
 
-void roundEdges()
+// evaluates the graph for the count cells (x[i], y[i]), init_noise() with the seed
+// of the field has to be called before
+void evaluateGraphCells(const Graph* graph, const int* x, const int* y, int count, double* out)
 {
-	printf("rounding edges: ");
-	erode();
-	for(int y = 0; y < 1024; ++y)
+	double stack[GRAPH_MAX_STACK][1024];
+	for(int start = 0; start < count; start += 1024)
 	{
-		for(int x = 0; x < 1024; ++x)
+		int n = MIN(count - start, 1024);
+		const int* xs = x + start;
+		const int* ys = y + start;
+		for(int o = 0; o < graph->count; ++o)
 		{
-			if(material[y][x] == GRASS && temp[y][x] == 0)
+			const GraphOp* op = &graph->op[o];
+			double* a = stack[op->slot];
+			double* b = stack[op->slot + 1];
+			switch(op->code)
 			{
-				material[y][x] = DIRT;
-				top[y][x] -= 1;
-				bottom[y][x] = top[y][x] - bottomMinThick;
+				case OP_NOISE:
+				{
+					double scale = op->arg[3] / 1024;
+					for(int i = 0; i < n; ++i) a[i] = scaled_octave_noise_2d(&op->noise, 0.0, 1.0, (xs[i] - 512) * scale + op->arg[4], (ys[i] - 512) * scale + op->arg[4]);
+					break;
+				}
+				case OP_FALLOFF:   for(int i = 0; i < n; ++i) a[i] = falloff(xs[i], ys[i]); break;
+				case OP_CONST:     for(int i = 0; i < n; ++i) a[i] = op->arg[0]; break;
+				case OP_ADD:       for(int i = 0; i < n; ++i) a[i] += b[i]; break;
+				case OP_SUB:       for(int i = 0; i < n; ++i) a[i] -= b[i]; break;
+				case OP_MUL:       for(int i = 0; i < n; ++i) a[i] *= b[i]; break;
+				case OP_DIV:       for(int i = 0; i < n; ++i) a[i] /= b[i]; break;
+				case OP_MIN:       for(int i = 0; i < n; ++i) a[i] = MIN(a[i], b[i]); break;
+				case OP_MAX:       for(int i = 0; i < n; ++i) a[i] = (a[i] > b[i]) ? a[i] : b[i]; break;
+				case OP_INVERT:    for(int i = 0; i < n; ++i) a[i] = 1.0 - a[i]; break;
+				case OP_ABS:       for(int i = 0; i < n; ++i) a[i] = fabs(a[i]); break;
+				case OP_POW:       for(int i = 0; i < n; ++i) a[i] = pow(a[i], op->arg[0]); break;
+				case OP_CLAMP:     for(int i = 0; i < n; ++i) a[i] = LIMIT(a[i], op->arg[0], op->arg[1]); break;
+				case OP_THRESHOLD: for(int i = 0; i < n; ++i) a[i] = (a[i] > op->arg[0]) ? 1.0 : 0.0; break;
 			}
 		}
+		memcpy(out + start, stack[0], n * sizeof(double));
 	}
+}
 
-	erode();
-	for(int y = 0; y < 1024; ++y)
+// evaluates the graph for count cells starting at (x0, y)
+void evaluateGraph(const Graph* graph, int x0, int y, int count, double* out)
+{
+	int xs[1024];
+	int ys[1024];
+	for(int start = 0; start < count; start += 1024)
 	{
-		for(int x = 0; x < 1024; ++x)
+		int n = MIN(count - start, 1024);
+		for(int i = 0; i < n; ++i)
 		{
-			if(material[y][x] == GRASS && temp[y][x] == 0)
-			{
-				material[y][x] = DIRT;
-				fraction[y][x] -=1;
-				if(fraction[y][x] == 0)
-				{
-					fraction[y][x] = 3;
-					top[y][x] -= 1;
-					bottom[y][x] = top[y][x] - bottomMinThick;
-				}
-			}
+			xs[i] = x0 + start + i;
+			ys[i] = y;
 		}
+		evaluateGraphCells(graph, xs, ys, n, out + start);
 	}
-	printf(" done.\n");
 }
 
-void generateBottom()
+// a rectangle of map cells [x0, x1) x [y0, y1)
+struct Rect
 {
-	printf("generating bottom: ");
-	srand(bottomSeed);
-	for(;;)
+	int x0, y0, x1, y1;
+};
+
+// tile occupancy index
+//
+// After the island outline is known, every OCC_TILE x OCC_TILE tile of the map
+// is classified as empty, partly or fully land, together with the bounding box
+// of its land cells. Land never disappears in later stages, so they only need
+// to visit the boxes.
+
+#define OCC_TILE 32
+#define OCC_TILES (1024 / OCC_TILE)
+
+#define TILE_EMPTY 0
+#define TILE_BOUNDARY 1
+#define TILE_LAND 2
+
+struct TileInfo
+{
+	unsigned char flags;
+	short x0, y0, x1, y1;
+};
+
+TileInfo (*occupancy)[OCC_TILES];
+int      occupiedTiles;
+
+void buildOccupancy()
+{
+	occupiedTiles = 0;
+	for(int ty = 0; ty < OCC_TILES; ++ty)
 	{
-		int i = 0;
-		for(int y = 0; y < 1024; ++y)
+		for(int tx = 0; tx < OCC_TILES; ++tx)
 		{
-			for(int x = 0; x < 1024; ++x)
+			TileInfo* t = &occupancy[ty][tx];
+			int x0 = 1024, y0 = 1024, x1 = 0, y1 = 0, count = 0;
+			for(int y = ty * OCC_TILE; y < (ty + 1) * OCC_TILE; ++y)
 			{
-				unsigned char max = 0;
-				if((unsigned char)(bottom[y-1][x] - 1) > max) max = (unsigned char)(bottom[y-1][x] - 1);
-				if((unsigned char)(bottom[y+1][x] - 1) > max) max = (unsigned char)(bottom[y+1][x] - 1);
-				if((unsigned char)(bottom[y][x-1] - 1) > max) max = (unsigned char)(bottom[y][x-1] - 1);
-				if((unsigned char)(bottom[y][x+1] - 1) > max) max = (unsigned char)(bottom[y][x+1] - 1);
-
-				if(max < bottom[y][x])
-				{
-					temp[y][x] = max;
-					temp[y][x] -= (1.0 + bottomAdd) * rand() / ((long)RAND_MAX + 1);
-					i++;
-				}
-				else
+				for(int x = tx * OCC_TILE; x < (tx + 1) * OCC_TILE; ++x)
 				{
-					temp[y][x] = bottom[y][x];
-					if(bottom[y][x] != 0)
-					{
-						unsigned char thickness = top[y][x] - bottom[y][x];
-						unsigned char thicknessConstant = 1;
-						if(top[y-1][x] - bottom[y-1][x] != thickness) thicknessConstant = 0;
-						if(top[y+1][x] - bottom[y+1][x] != thickness) thicknessConstant = 0;
-						if(top[y][x-1] - bottom[y][x-1] != thickness) thicknessConstant = 0;
-						if(top[y][x+1] - bottom[y][x+1] != thickness) thicknessConstant = 0;
-						if(thicknessConstant)
-						{
-							temp[y][x] -= (1.0 + bottomAdd) * rand() / ((long)RAND_MAX + 1);
-							i++;
-						}
-					}
+					if(material[cell(x, y)] == 0) continue;
+					count++;
+					x0 = MIN(x0, x);
+					x1 = MAX(x1, x + 1);
+					y0 = MIN(y0, y);
+					y1 = MAX(y1, y + 1);
 				}
 			}
+			if(count == 0)
+			{
+				t->flags = TILE_EMPTY;
+				t->x0 = t->y0 = t->x1 = t->y1 = 0;
+				continue;
+			}
+			t->flags = (count == OCC_TILE * OCC_TILE) ? TILE_LAND : TILE_BOUNDARY;
+			t->x0 = x0;
+			t->y0 = y0;
+			t->x1 = x1;
+			t->y1 = y1;
+			occupiedTiles++;
 		}
-		memcpy(bottom, temp, 1024 * 1024);
-		if(i == 0) break;
 	}
-	printf(" done.\n");
 }
 
-void plantTrees()
+void forEachLandBox(void (*f)(Rect r))
 {
-	printf("planting trees: ");
-	init_noise(treeSeed);
-	srand(treeSeedPos);
-	int i = 0;
-	int j = 0;
-	while(i < treeNumber)
+	for(int ty = 0; ty < OCC_TILES; ++ty)
 	{
-		if(j++ > 1024 * 1024 * 8) break;
-
-		int x = rand() % 1024;
-		int y = rand() % 1024;
-
-		if(material[y][x] != GRASS) continue;
-
-		double val = scaled_octave_noise_2d(treeOctaves, treeOctavePersistence, treeOctaveScale, 0.0, 1.0, (x - 512) * treeScale / 1024, (y - 512) * treeScale / 1024);
-		if(treeFalloff) val *= falloff(x, y);
-		if(treeValueInvert) val = 1.0 - val;
-		if(val > treeDensity)
+		for(int tx = 0; tx < OCC_TILES; ++tx)
 		{
-			trees[i++] = ((top[y][x] - 1) << 20) + (y << 10) + x;
-			material[y][x] = DIRT;
+			const TileInfo* t = &occupancy[ty][tx];
+			if(t->flags == TILE_EMPTY) continue;
+			Rect r = {t->x0, t->y0, t->x1, t->y1};
+			f(r);
 		}
 	}
-	if(i < treeNumber)
-	{
-		printf("\ncould only plant %d trees\n", i);
-		treeNumber = i;
-	}
-	printf(" done.\n");
 }
 
-void growCrystals()
+int regionIsEmpty(int rx, int ry)
 {
-	printf("growing crystals: ");
-	srand(crystalSeed);
-	int i = 0;
-	int j = 0;
-	while(i < crystalNumber)
+	for(int ty = ry * (256 / OCC_TILE); ty < (ry + 1) * (256 / OCC_TILE); ++ty)
 	{
-		if(j++ > 1024 * 1024 * 8) break;
-		int x = (rand() % (1022 - 2 * crystalGrassRadius)) + crystalGrassRadius + 1;
-		int y = (rand() % (1022 - 2 * crystalGrassRadius)) + crystalGrassRadius + 1;
-
-		if(material[y][x] != GRASS) continue;
-
-		unsigned char isOK = 1;
-		for(int j = 0; isOK && j < i; j++)
+		for(int tx = rx * (256 / OCC_TILE); tx < (rx + 1) * (256 / OCC_TILE); ++tx)
 		{
-			int dx = crystals[j] % 1024 - x;
-			int dy = (crystals[j] >> 10) % 1024 - y;
-			if(dx * dx + dy * dy < crystalDistance * crystalDistance) isOK = 0;
+			if(occupancy[ty][tx].flags != TILE_EMPTY) return 0;
 		}
-		if(!isOK) continue;
+	}
+	return 1;
+}
 
-		if(fabs((double)(top[y][x] - top[y - crystalGrassRadius][x]) / crystalGrassRadius) > crystalMaxSlope) isOK = 0;
-		if(fabs((double)(top[y][x] - top[y + crystalGrassRadius][x]) / crystalGrassRadius) > crystalMaxSlope) isOK = 0;
-		if(fabs((double)(top[y][x] - top[y][x - crystalGrassRadius]) / crystalGrassRadius) > crystalMaxSlope) isOK = 0;
-		if(fabs((double)(top[y][x] - top[y][x + crystalGrassRadius]) / crystalGrassRadius) > crystalMaxSlope) isOK = 0;
-		if(fabs((double)(top[y][x] - top[y - crystalGrassRadius / 2][x]) / (crystalGrassRadius / 2)) > crystalMaxSlope) isOK = 0;
-		if(fabs((double)(top[y][x] - top[y + crystalGrassRadius / 2][x]) / (crystalGrassRadius / 2)) > crystalMaxSlope) isOK = 0;
-		if(fabs((double)(top[y][x] - top[y][x - crystalGrassRadius / 2]) / (crystalGrassRadius / 2)) > crystalMaxSlope) isOK = 0;
-		if(fabs((double)(top[y][x] - top[y][x + crystalGrassRadius / 2]) / (crystalGrassRadius / 2)) > crystalMaxSlope) isOK = 0;
-		if(!isOK) continue;
+// world buffers
+//
+// All planes and lists of a world live in one aligned arena, followed by a
+// scratch area that stages allocate from with scratchAlloc() and give back with
+// scratchRelease(). Arenas are recycled through a pool, so processes generating
+// many worlds do not pay for allocation and page faults per world. The pool
+// belongs to one process: a forked task neither recycles nor clears the arenas
+// it inherited, writing them would copy every page. A new arena starts with
+// zero pages; on reuse only the land boxes of the last world are cleared in the
+// planes that stages write partially (top, fraction, bottom), the others are
+// always fully overwritten before they are read.
 
-		for(int ty = y - crystalGrassRadius; isOK && ty < y + crystalGrassRadius; ++ty)
-		{
-			for(int tx = x - crystalGrassRadius; isOK && tx < x + crystalGrassRadius; ++tx)
-			{
-				int dx = tx - x;
-				int dy = ty - y;
-				if(dx * dx + dy * dy <= crystalGrassRadius * crystalGrassRadius && material[ty][tx] != GRASS) isOK = 0;
-			}
-		}
-		if(!isOK) continue;
+#define WORLD_ALIGN (2 * 1024 * 1024)
+#define WORLD_SCRATCH (8 * 1024 * 1024)
+#define WORLD_POOL_MAX 64
 
-		crystals[i] = ((top[y][x] - 1) << 20) + (y << 10) + x;
-		i++;
-	}
+struct World
+{
+	unsigned char* arena;
+	size_t         size;
+	size_t         scratchStart;
+	size_t         scratchUsed;
+	size_t         scratchPeak;
+	size_t         overflowPeak;
+	int            reused;
+	int            process;  // the arena is only recycled by the process that made it
 
-	if(i < crystalNumber)
-	{
-		printf("\ncould only grow %d crystals\n", i);
-		crystalNumber = i;
-	}
+	unsigned char* top;
+	unsigned char* bottom;
+	unsigned char* material;
+	unsigned char* fraction;
+	unsigned char* temp;
+	short        (*erosion)[1024 * 1024];
+	double        (*falloffField)[513][513];
+	double         falloffSize;   // island size and edge the falloff field was computed for
+	double         falloffEdge;
+	unsigned int*  trees;
+	unsigned int*  crystals;
+	TileInfo      (*occupancy)[OCC_TILES];
+};
 
-	if(crystalNumber)
-	{
-		double angle = 2 * M_PI * rand() / ((long)RAND_MAX + 1);
-		int dx = cos(angle) * crystalStartPointDistance;
-		int dy = sin(angle) * crystalStartPointDistance;
-		int x = crystals[0] % 1024 + dx;
-		int y = (crystals[0] >> 10) % 1024 + dy;
-		startPoint = ((top[y][x] - 1) << 20) + (y << 10) + x;
-	}
-	else
-	{
-		printf("warning: no crystals, start point will be invalid\n");
-	}
+struct WorldPool
+{
+	std::mutex lock;
+	World*     free[WORLD_POOL_MAX];
+	int        count;
+	long       created;
+	long       recycled;
+};
 
-	printf(" done.\n");
+WorldPool worldPool;
+World*    world;
+
+int currentProcess()
+{
+	#ifdef _WIN32
+	return _getpid();
+	#else
+	return getpid();
+	#endif
 }
 
-void checkError(FILE* out, char* fname)
+// on linux a private mapping, its pages are zero until written
+unsigned char* allocArena(size_t size)
 {
-	if(!out)
+	void* p = 0;
+	#ifdef __linux__
+	unsigned char* m = (unsigned char*)mmap(0, size + WORLD_ALIGN, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(m != MAP_FAILED)
 	{
-		printf("Could not open %s, aborting", fname);
+		size_t head = (WORLD_ALIGN - (size_t)m % WORLD_ALIGN) % WORLD_ALIGN;
+		if(head) munmap(m, head);
+		munmap(m + head + size, WORLD_ALIGN - head);
+		p = m + head;
+	}
+	#elif defined(_WIN32)
+	p = _aligned_malloc(size, WORLD_ALIGN);
+	#else
+	if(posix_memalign(&p, WORLD_ALIGN, size)) p = 0;
+	#endif
+	if(!p)
+	{
+		printf("Could not allocate %lu bytes for world buffers, aborting\n", (unsigned long)size);
 		exit(EXIT_FAILURE);
 	}
+	#ifdef __linux__
+	if(hugePages) madvise(p, size, MADV_HUGEPAGE);
+	#endif
+	return (unsigned char*)p;
 }
 
-void writePGM(char* fname, unsigned char* data, int width, int height)
+void freeArena(unsigned char* p, size_t size)
 {
-	FILE* out = fopen(fname, "wb");
-	checkError(out, fname);
-	fprintf(out, "P5\n%d %d\n255\n", width, height);
-	fwrite(data, 1, width*height, out);
-	fclose(out);
+	#ifdef __linux__
+	munmap(p, size);
+	#elif defined(_WIN32)
+	(void)size;
+	_aligned_free(p);
+	#else
+	(void)size;
+	free(p);
+	#endif
 }
 
-void writePGMs()
+// carves the planes out of the arena, every part starts on a cache line
+size_t layoutWorld(World* w)
 {
-	char fname[512];
-	sprintf(fname, "%s/mat.pgm", outputDir);
-	writePGM(fname, &material[0][0], 1024, 1024);
-	sprintf(fname, "%s/top.pgm", outputDir);
-	writePGM(fname, &top[0][0], 1024, 1024);
-	sprintf(fname, "%s/fra.pgm", outputDir);
-	writePGM(fname, &fraction[0][0], 1024, 1024);
-	sprintf(fname, "%s/bot.pgm", outputDir);
-	writePGM(fname, &bottom[0][0], 1024, 1024);
+	size_t offset = 0;
+	#define WORLD_PART(member, bytes) w->member = (decltype(w->member))(w->arena ? w->arena + offset : 0); offset += ((bytes) + 63) / 64 * 64;
+	WORLD_PART(material, 1024 * 1024);
+	WORLD_PART(top, 1024 * 1024);
+	WORLD_PART(bottom, 1024 * 1024);
+	WORLD_PART(fraction, 1024 * 1024);
+	WORLD_PART(temp, 1024 * 1024);
+	WORLD_PART(erosion, 2 * 1024 * 1024 * sizeof(short));
+	WORLD_PART(falloffField, 513 * 513 * sizeof(double));
+	WORLD_PART(trees, 32768 * sizeof(unsigned int));
+	WORLD_PART(crystals, 512 * sizeof(unsigned int));
+	WORLD_PART(occupancy, OCC_TILES * OCC_TILES * sizeof(TileInfo));
+	#undef WORLD_PART
+	return offset;
 }
 
+// clears top, bottom and fraction in the land boxes of the last world of a recycled
+// arena; the island stage is the only one that makes cells ocean and the later
+// stages write these planes only inside the boxes, so all other cells are zero
+void clearLand(World* w)
+{
+	for(int ty = 0; ty < OCC_TILES; ++ty)
+	{
+		for(int tx = 0; tx < OCC_TILES; ++tx)
+		{
+			const TileInfo* t = &w->occupancy[ty][tx];
+			if(t->flags == TILE_EMPTY) continue;
+			for(int y = t->y0; y < t->y1; ++y)
+			{
+				for(int x = t->x0; x < t->x1; ++x)
+				{
+					int c = cell(x, y);
+					w->top[c] = 0;
+					w->bottom[c] = 0;
+					w->fraction[c] = 0;
+				}
+			}
+		}
+	}
+}
+
+World* acquireWorld()
+{
+	World* w = 0;
+	int process = currentProcess();
+	{
+		std::lock_guard<std::mutex> guard(worldPool.lock);
+		// arenas inherited from the parent process are left alone
+		while(worldPool.count && !w)
+		{
+			w = worldPool.free[--worldPool.count];
+			if(w->process != process) w = 0;
+		}
+		if(w) worldPool.recycled++;
+		else worldPool.created++;
+	}
+	if(w)
+	{
+		w->reused = 1;
+		clearLand(w);
+	}
+	else
+	{
+		w = new World();
+		w->scratchStart = layoutWorld(w);
+		w->size = (w->scratchStart + WORLD_SCRATCH + WORLD_ALIGN - 1) / WORLD_ALIGN * WORLD_ALIGN;
+		w->arena = allocArena(w->size);
+		layoutWorld(w);
+		w->reused = 0;
+		w->process = process;
+		w->falloffSize = w->falloffEdge = -1.0;
+		#ifndef __linux__
+		memset(w->top, 0, 1024 * 1024);
+		memset(w->bottom, 0, 1024 * 1024);
+		memset(w->fraction, 0, 1024 * 1024);
+		memset(w->occupancy, 0, OCC_TILES * OCC_TILES * sizeof(TileInfo));
+		#endif
+	}
+	w->scratchUsed = 0;
+	w->scratchPeak = 0;
+	w->overflowPeak = 0;
+	return w;
+}
+
+// a world inherited from the parent process is not pooled, dropping it only
+// unmaps this process's view of it
+void releaseWorld(World* w)
+{
+	if(w->process == currentProcess())
+	{
+		std::lock_guard<std::mutex> guard(worldPool.lock);
+		if(worldPool.count < WORLD_POOL_MAX)
+		{
+			worldPool.free[worldPool.count++] = w;
+			return;
+		}
+	}
+	freeArena(w->arena, w->size);
+	delete w;
+}
+
+// makes the planes of w the ones the stages work on; the stages read the global
+// plane pointers, not a World, so a process generates one world at a time and
+// concurrent generations (-batch, -search, -queue, -bench) run in forked processes
+void bindWorld(World* w)
+{
+	world = w;
+	top = w->top;
+	bottom = w->bottom;
+	material = w->material;
+	fraction = w->fraction;
+	temp = w->temp;
+	erosion = w->erosion;
+	falloffField = w->falloffField;
+	trees = w->trees;
+	crystals = w->crystals;
+	occupancy = w->occupancy;
+}
+
+// fills the falloff field of the current world, a recycled world keeps its
+// field if it was made for the same island size and edge; only one triangle
+// of offsets is computed, the field is symmetric in x and y
+void prepareFalloff()
+{
+	if(world->falloffSize == islandSize && world->falloffEdge == islandEdge) return;
+	for(int ay = 0; ay <= 512; ++ay)
+	{
+		for(int ax = 0; ax <= ay; ++ax)
+		{
+			double v = falloffExact(512 + ax, 512 + ay);
+			falloffField[0][ay][ax] = falloffField[0][ax][ay] = v;
+		}
+	}
+	world->falloffSize = islandSize;
+	world->falloffEdge = islandEdge;
+}
+
+// scratch memory for the current stage, released in reverse order; requests that
+// do not fit the scratch area fall back to the heap (and show up in the report)
+void* scratchAlloc(size_t bytes)
+{
+	bytes = (bytes + 63) / 64 * 64;
+	if(world->scratchStart + world->scratchUsed + bytes > world->size)
+	{
+		world->overflowPeak = MAX(world->overflowPeak, bytes);
+		return malloc(bytes);
+	}
+	void* p = world->arena + world->scratchStart + world->scratchUsed;
+	world->scratchUsed += bytes;
+	world->scratchPeak = MAX(world->scratchPeak, world->scratchUsed);
+	return p;
+}
+
+void scratchRelease(void* p, size_t bytes)
+{
+	unsigned char* c = (unsigned char*)p;
+	if(c < world->arena || c >= world->arena + world->size)
+	{
+		free(p);
+		return;
+	}
+	world->scratchUsed -= (bytes + 63) / 64 * 64;
+}
+
+void printMemoryReport()
+{
+	printf("world buffers: %.1lf MB arena (%s), %.1lf MB planes, scratch peak %.1lf KB",
+		world->size / 1048576.0, world->reused ? "reused" : "new", world->scratchStart / 1048576.0, world->scratchPeak / 1024.0);
+	if(world->overflowPeak) printf(", largest heap fallback %.1lf KB", world->overflowPeak / 1024.0);
+	printf("\n");
+	printf("world pool: %ld arenas created, %ld recycled\n", worldPool.created, worldPool.recycled);
+}
+
+// the terrain planes of a rectangle of the map, addressed in map coordinates
+// the full map window uses the global planes, the tiled mode small local ones
+struct Window
+{
+	Rect r;
+	int stride;
+	unsigned char* material;
+	unsigned char* top;
+	unsigned char* fraction;
+	unsigned char* bottom;
+	unsigned char* temp;
+
+	int at(int x, int y) const { return (MAP_STRIDE || stride) ? (y - r.y0) * stride + (x - r.x0) : cell(x, y); }
+};
+
+const Rect fullRect = {0, 0, 1024, 1024};
+
+Window fullWindow()
+{
+	Window w = {fullRect, MAP_STRIDE, material, top, fraction, bottom, temp};
+	return w;
+}
+
+// adaptive sampling
+//
+// With -ae each octave of the island and height noise is evaluated on a grid
+// with the largest power of two spacing (up to ADAPTIVE_MAX_STEP cells) for
+// which bilinear interpolation stays within its share of the error bound. The
+// interpolation error on a grid of spacing h is at most h^2 / 8 * (max |fxx| +
+// max |fyy|). For raw_noise_2d every one of the 3 corners adds 70 t^4 (g . d)
+// with t = 0.5 - |d|^2 >= 0 and |g| <= sqrt 2, whose second derivative along an
+// axis is at most 70 r (sqrt 2 (48 t^2 r^2 + 8 t^3) + 16 t^3) for r = |d|, largest
+// (65.65) at r = 0.378. So max |fxx| + max |fyy| <= 2 * 3 * 65.65, rounded up in
+// ADAPTIVE_CURVATURE; a bound, not a measured value. Octaves that would need a
+// spacing of one cell are evaluated exactly.
+
+#define ADAPTIVE_MAX_STEP 64
+#define ADAPTIVE_CURVATURE 394.0
+
+long adaptiveCells;
+long adaptiveExactCells;
+
+// returns the grid spacing for an octave and its worst case error (in [0, 1] units)
+int adaptiveStep(const octave_noise_2d_setup* noise, double scale, int octave, double* error)
+{
+	double frequency = noise->scale * pow(2.0, octave);
+	double amplitude = pow(noise->persistence, octave) / noise->maxAmplitude;
+	double perCell = scale / 1024 * frequency;
+	for(int step = ADAPTIVE_MAX_STEP; step > 1; step /= 2)
+	{
+		double h = step * perCell;
+		double e = h * h / 8 * ADAPTIVE_CURVATURE * amplitude * 0.5;
+		if(e <= adaptiveBound / noise->octaves)
+		{
+			*error = e;
+			return step;
+		}
+	}
+	*error = 0.0;
+	return 1;
+}
+
+// fills value (octave noise in [-1, 1]) for the cells of the rect (row stride
+// r.x1 - r.x0); with a mask window, exactly evaluated octaves skip ocean cells;
+// returns the worst case error in [0, 1] units
+double adaptiveNoiseRect(const octave_noise_2d_setup* noise, double scale, Rect r, const Window* mask, double* value)
+{
+	int width = r.x1 - r.x0;
+	int count = width * (r.y1 - r.y0);
+	double error = 0.0;
+	memset(value, 0, count * sizeof(double));
+
+	for(int o = 0; o < noise->octaves; ++o)
+	{
+		double e;
+		int step = adaptiveStep(noise, scale, o, &e);
+		error += e;
+		double frequency = noise->scale * pow(2.0, o);
+		double amplitude = pow(noise->persistence, o);
+		double f = scale / 1024 * frequency;
+
+		if(step == 1)
+		{
+			for(int y = r.y0; y < r.y1; ++y)
+			{
+				for(int x = r.x0; x < r.x1; ++x)
+				{
+					if(mask && mask->material[mask->at(x, y)] == 0) continue;
+					int j = (y - r.y0) * width + x - r.x0;
+					value[j] += raw_noise_2d((x - 512) * f, (y - 512) * f) * amplitude;
+				}
+			}
+			continue;
+		}
+
+		// grid points are aligned to multiples of the step in map coordinates
+		int gx0 = r.x0 / step * step;
+		int gy0 = r.y0 / step * step;
+		int gw = (r.x1 - 1 - gx0) / step + 2;
+		int gh = (r.y1 - 1 - gy0) / step + 2;
+		double* grid = (double*)scratchAlloc(gw * gh * sizeof(double));
+		for(int gy = 0; gy < gh; ++gy)
+		{
+			for(int gx = 0; gx < gw; ++gx)
+			{
+				int k = gy * gw + gx;
+				double nx = (gx0 + gx * step - 512) * f;
+				double ny = (gy0 + gy * step - 512) * f;
+				grid[k] = raw_noise_2d(nx, ny);
+			}
+		}
+		// interpolate along y into one line per row, then along x
+		int* cell = (int*)scratchAlloc(width * sizeof(int));
+		double* tx = (double*)scratchAlloc(width * sizeof(double));
+		double* line = (double*)scratchAlloc(gw * sizeof(double));
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			cell[x - r.x0] = (x - gx0) / step;
+			tx[x - r.x0] = (double)((x - gx0) % step) / step;
+		}
+		for(int y = r.y0; y < r.y1; ++y)
+		{
+			int gy = (y - gy0) / step;
+			double ty = (double)((y - gy0) % step) / step;
+			const double* g0 = grid + gy * gw;
+			const double* g1 = g0 + gw;
+			for(int gx = 0; gx < gw; ++gx) line[gx] = (g0[gx] + (g1[gx] - g0[gx]) * ty) * amplitude;
+			double* out = value + (y - r.y0) * width;
+			for(int i = 0; i < width; ++i)
+			{
+				int c = cell[i];
+				out[i] += line[c] + (line[c + 1] - line[c]) * tx[i];
+			}
+		}
+		scratchRelease(line, gw * sizeof(double));
+		scratchRelease(tx, width * sizeof(double));
+		scratchRelease(cell, width * sizeof(int));
+		scratchRelease(grid, gw * gh * sizeof(double));
+	}
+
+	for(int j = 0; j < count; ++j) value[j] /= noise->maxAmplitude;
+	return error;
+}
+
+// octave layer cache
+//
+// With -lc the raw noise of every octave of the island and height fields is kept
+// per cell. The samples do not depend on persistence or on anything applied after
+// the noise, so changing only those sums the kept octaves in the same order as
+// the noise functions (same bits). A layer is identified by field, seed, field
+// scale and octave frequency, its cells are NaN until first needed; filling them
+// needs init_noise() with the seed of the field. With -lcdir every layer is a
+// file of native doubles, mapped copy on write (read elsewhere) when the layer is first used, so
+// only the pages of the cells used are loaded, and written back when it has new cells.
+
+#define LAYER_ISLAND 0
+#define LAYER_HEIGHT 1
+#define LAYER_MAX 16
+#define LAYER_CELLS (1024 * 1024)
+
+struct NoiseLayer
+{
+	int     field;
+	int     seed;
+	double  scale;      // -is or -hs
+	double  frequency;  // of the octave
+	long    filled;     // cells filled since the layer was read or written
+	int     mapped;
+	double* data;
+};
+
+NoiseLayer noiseLayers[LAYER_MAX];
+int        noiseLayerCount;
+int        noiseLayerOldest;
+long       layerCellsFilled;
+
+void layerFileName(const NoiseLayer* l, char* fname, size_t size)
+{
+	snprintf(fname, size, "%s/%s_%d_%.17g_%.17g.layer", layerDir, (l->field == LAYER_ISLAND) ? "island" : "height", l->seed, l->scale, l->frequency);
+}
+
+void saveLayer(NoiseLayer* l)
+{
+	if(!strcmp(layerDir, "") || !l->filled) return;
+	char fname[1024];
+	layerFileName(l, fname, sizeof(fname));
+	// the old file may still be mapped, the new one replaces it by name; the part
+	// name is per process, runs sharing -lcdir do not write into each other's part
+	char part[1060];
+	#ifdef _WIN32
+	snprintf(part, sizeof(part), "%s.%d.part", fname, _getpid());
+	#else
+	snprintf(part, sizeof(part), "%s.%d.part", fname, (int)getpid());
+	#endif
+	FILE* out = fopen(part, "wb");
+	if(!out || fwrite(l->data, sizeof(double), LAYER_CELLS, out) != LAYER_CELLS)
+	{
+		printf("\nCould not write %s, aborting\n", part);
+		exit(EXIT_FAILURE);
+	}
+	fclose(out);
+	#ifdef _WIN32
+	remove(fname);
+	#endif
+	if(rename(part, fname))
+	{
+		printf("\nCould not write %s, aborting\n", fname);
+		exit(EXIT_FAILURE);
+	}
+	l->filled = 0;
+}
+
+// maps or reads the file of a layer, returns 0 if there is none of the right size
+double* readLayer(const NoiseLayer* l, int* mapped)
+{
+	char fname[1024];
+	size_t bytes = LAYER_CELLS * sizeof(double);
+	layerFileName(l, fname, sizeof(fname));
+	*mapped = 0;
+	#ifdef __linux__
+	int fd = open(fname, O_RDONLY);
+	if(fd < 0) return 0;
+	struct stat info;
+	void* p = MAP_FAILED;
+	if(!fstat(fd, &info) && (size_t)info.st_size == bytes) p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) return 0;
+	*mapped = 1;
+	return (double*)p;
+	#else
+	FILE* in = fopen(fname, "rb");
+	if(!in) return 0;
+	double* data = (double*)malloc(bytes);
+	if(data && fread(data, 1, bytes, in) != bytes)
+	{
+		free(data);
+		data = 0;
+	}
+	fclose(in);
+	return data;
+	#endif
+}
+
+void freeLayer(NoiseLayer* l)
+{
+	#ifdef __linux__
+	if(l->mapped)
+	{
+		munmap(l->data, LAYER_CELLS * sizeof(double));
+		return;
+	}
+	#endif
+	free(l->data);
+}
+
+void saveLayers()
+{
+	for(int i = 0; i < noiseLayerCount; ++i) saveLayer(&noiseLayers[i]);
+}
+
+// the layer of one octave, read from -lcdir if it is there; when the table is
+// full the oldest layer is written and dropped
+NoiseLayer* noiseLayer(int field, int seed, double scale, double frequency)
+{
+	for(int i = 0; i < noiseLayerCount; ++i)
+	{
+		NoiseLayer* l = &noiseLayers[i];
+		if(l->field == field && l->seed == seed && l->scale == scale && l->frequency == frequency) return l;
+	}
+	NoiseLayer* l;
+	if(noiseLayerCount == LAYER_MAX)
+	{
+		l = &noiseLayers[noiseLayerOldest];
+		noiseLayerOldest = (noiseLayerOldest + 1) % LAYER_MAX;
+		saveLayer(l);
+		freeLayer(l);
+	}
+	else l = &noiseLayers[noiseLayerCount++];
+	l->field = field;
+	l->seed = seed;
+	l->scale = scale;
+	l->frequency = frequency;
+	l->filled = 0;
+	l->data = strcmp(layerDir, "") ? readLayer(l, &l->mapped) : 0;
+	if(l->data) return l;
+	size_t count = LAYER_CELLS;
+	l->mapped = 0;
+	l->data = (double*)malloc(count * sizeof(double));
+	if(!l->data)
+	{
+		printf("\nout of memory for the octave layers, aborting\n");
+		exit(EXIT_FAILURE);
+	}
+	memset(l->data, 0xff, count * sizeof(double));
+	return l;
+}
+
+// the layers of every octave of a field, 0 without -lc or with more octaves
+// than both fields fit into the table
+int fieldLayers(int field, int seed, double scale, const octave_noise_2d_setup* noise, NoiseLayer** layers)
+{
+	if(!layerCache || 2 * noise->octaves > LAYER_MAX) return 0;
+	double frequency = noise->scale;
+	for(int o = 0; o < noise->octaves; ++o)
+	{
+		layers[o] = noiseLayer(field, seed, scale, frequency);
+		frequency *= 2;
+	}
+	return 1;
+}
+
+// raw noise of a layer at cell (x, y), nx and ny are the noise coordinates of its octave
+static inline double layerNoise(NoiseLayer* l, int x, int y, double nx, double ny)
+{
+	double* v = l->data + y * 1024 + x;
+	if(isnan(*v))
+	{
+		*v = raw_noise_2d(nx, ny);
+		l->filled++;
+		layerCellsFilled++;
+	}
+	return *v;
+}
+
+// octave_noise_2d_classify() from the layers
+int layerClassify(NoiseLayer** layers, const octave_noise_2d_setup* noise, int x, int y, double nx, double ny, double lo, double hi, double* value)
+{
+	double total = 0;
+	double frequency = noise->scale;
+	double amplitude = 1;
+	double remaining = noise->maxAmplitude;
+	for(int o = 0; o < noise->octaves; ++o)
+	{
+		if((total + remaining) / noise->maxAmplitude < lo) return -1;
+		if((total - remaining) / noise->maxAmplitude > hi) return 1;
+		total += layerNoise(layers[o], x, y, nx * frequency, ny * frequency) * amplitude;
+		frequency *= 2;
+		remaining -= amplitude;
+		amplitude *= noise->persistence;
+	}
+	*value = total / noise->maxAmplitude;
+	return 0;
+}
+
+// octave_noise_2d() from the layers
+double layerOctaveNoise(NoiseLayer** layers, const octave_noise_2d_setup* noise, int x, int y, double nx, double ny)
+{
+	double total = 0;
+	double frequency = noise->scale;
+	double amplitude = 1;
+	for(int o = 0; o < noise->octaves; ++o)
+	{
+		total += layerNoise(layers[o], x, y, nx * frequency, ny * frequency) * amplitude;
+		frequency *= 2;
+		amplitude *= noise->persistence;
+	}
+	return total / noise->maxAmplitude;
+}
+
+// fills the layers of a field for all cells of r, land or not
+void fillLayers(int field, Rect r)
+{
+	int seed = (field == LAYER_ISLAND) ? islandSeed : heightSeed;
+	double scale = (field == LAYER_ISLAND) ? islandScale : heightScale;
+	octave_noise_2d_setup noise;
+	if(field == LAYER_ISLAND) init_octave_noise_2d(&noise, islandOctaves, islandOctavePersistence, islandOctaveScale);
+	else init_octave_noise_2d(&noise, heightOctaves, heightOctavePersistence, heightOctaveScale);
+	NoiseLayer* layers[LAYER_MAX];
+	if(!fieldLayers(field, seed, scale, &noise, layers)) return;
+	init_noise(seed);
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			double nx = (x - 512) * scale / 1024;
+			double ny = (y - 512) * scale / 1024;
+			double frequency = noise.scale;
+			for(int o = 0; o < noise.octaves; ++o)
+			{
+				layerNoise(layers[o], x, y, nx * frequency, ny * frequency);
+				frequency *= 2;
+			}
+		}
+	}
+}
+
+void fillHeightLayers(Rect r)
+{
+	fillLayers(LAYER_HEIGHT, r);
+}
+
+void printLayerReport()
+{
+	double mb = 0.0;
+	for(int i = 0; i < noiseLayerCount; ++i) mb += LAYER_CELLS * sizeof(double) / 1048576.0;
+	printf("octave layers: %d kept, %.1lf MB, %ld cells filled in this run\n", noiseLayerCount, mb, layerCellsFilled);
+}
+
+// only the threshold decision matters: with falloff 0 the value is 0, otherwise
+// the octaves stop once the outcome is certain (with a margin for rounding,
+// undecided cells get the exact value)
+int islandCell(const octave_noise_2d_setup* noise, NoiseLayer** layers, int x, int y, double threshold)
+{
+	double f = falloff(x, y);
+	if(f == 0.0) return 0.0 > threshold;
+	double n;
+	double level = (threshold / f - 0.5) * 2.0;
+	double nx = (x - 512) * islandScale / 1024;
+	double ny = (y - 512) * islandScale / 1024;
+	int c;
+	if(layers) c = layerClassify(layers, noise, x, y, nx, ny, level - 1e-9, level + 1e-9, &n);
+	else c = octave_noise_2d_classify(noise, nx, ny, level - 1e-9, level + 1e-9, &n);
+	if(c != 0) return c > 0;
+	return (n * (1.0 - 0.0) / 2 + (1.0 + 0.0) / 2) * f > threshold;
+}
+
+// adaptive variant, cells whose interpolated value is not clearly on one side of
+// the threshold are decided by islandCell()
+void islandAdaptiveRect(const Window* w, const octave_noise_2d_setup* noise, Rect r)
+{
+	double threshold = 1.0 - islandDensity;
+	for(int y0 = r.y0; y0 < r.y1; y0 += 64)
+	{
+		// outside the falloff disk the value is 0, only the columns it covers are sampled
+		int y1 = MIN(y0 + 64, r.y1);
+		double radius = islandSize * 512.0;
+		double dy = MIN(fabs(y0 - 512.0), fabs(y1 - 1 - 512.0));
+		if(y0 <= 512 && y1 > 512) dy = 0.0;
+		double half = (radius > dy) ? sqrt(radius * radius - dy * dy) + 2.0 : 0.0;
+		int x0 = LIMIT((int)(512.0 - half), r.x0, r.x1);
+		int x1 = LIMIT((int)(512.0 + half) + 1, r.x0, r.x1);
+		for(int y = y0; y < y1; ++y)
+		{
+			for(int x = r.x0; x < x0; ++x) w->material[w->at(x, y)] = islandCell(noise, 0, x, y, threshold) ? GRASS : 0;
+			for(int x = x1; x < r.x1; ++x) w->material[w->at(x, y)] = islandCell(noise, 0, x, y, threshold) ? GRASS : 0;
+		}
+		if(x0 >= x1) continue;
+		Rect band = {x0, y0, x1, y1};
+		int width = band.x1 - band.x0;
+		double* value = (double*)scratchAlloc(width * (band.y1 - band.y0) * sizeof(double));
+		double error = adaptiveNoiseRect(noise, islandScale, band, 0, value);
+		for(int y = band.y0; y < band.y1; ++y)
+		{
+			for(int x = band.x0; x < band.x1; ++x)
+			{
+				double f = falloff(x, y);
+				double val = (value[(y - band.y0) * width + x - band.x0] * 0.5 + 0.5) * f;
+				int land;
+				if(fabs(val - threshold) <= (error + 1e-9) * f)
+				{
+					land = islandCell(noise, 0, x, y, threshold);
+					adaptiveExactCells++;
+				}
+				else land = val > threshold;
+				w->material[w->at(x, y)] = land ? GRASS : 0;
+			}
+		}
+		adaptiveCells += width * (band.y1 - band.y0);
+		scratchRelease(value, width * (band.y1 - band.y0) * sizeof(double));
+	}
+}
+
+void islandRect(const Window* w, const octave_noise_2d_setup* noise, Rect r)
+{
+	if(!islandGraph.count && adaptiveBound > 0.0)
+	{
+		islandAdaptiveRect(w, noise, r);
+		return;
+	}
+	double threshold = 1.0 - islandDensity;
+	double row[1024];
+	NoiseLayer* layers[LAYER_MAX];
+	int cached = !islandGraph.count && fieldLayers(LAYER_ISLAND, islandSeed, islandScale, noise, layers);
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		if(islandGraph.count) evaluateGraph(&islandGraph, r.x0, y, r.x1 - r.x0, row);
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			int land;
+			if(islandGraph.count) land = row[x - r.x0] > threshold;
+			else land = islandCell(noise, cached ? layers : 0, x, y, threshold);
+			w->material[w->at(x, y)] = land ? GRASS : 0;
+		}
+	}
+}
+
+void generateIsland()
+{
+	printf("generating island outline: ");
+	init_noise(islandSeed);
+	octave_noise_2d_setup noise;
+	init_octave_noise_2d(&noise, islandOctaves, islandOctavePersistence, islandOctaveScale);
+	Window w = fullWindow();
+	islandRect(&w, &noise, fullRect);
+	buildOccupancy();
+	printf(" done.\n");
+}
+
+void heightGraphRow(int y, int x0, int count, double* out)
+{
+	evaluateGraph(&heightGraph, x0, LIMIT(y, 0, 1023), count, out);
+	for(int x = 0; x < count; ++x) out[x] = heightBase + (heightTop - heightBase) * out[x];
+}
+
+// height field from the noise graph, one row at a time
+void topGraphRect(const Window* w, Rect r)
+{
+	double row[1024];
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		heightGraphRow(y, r.x0, r.x1 - r.x0, row);
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			int i = w->at(x, y);
+			if(w->material[i] == 0) continue;
+			double height = row[x - r.x0];
+			w->top[i] = height;
+			w->fraction[i] = (height - w->top[i]) * 3.0 + 1.0;
+			w->bottom[i] = w->top[i] - bottomMinThick;
+		}
+	}
+}
+
+// maps the scaled height noise through falloff, invert and the exponent,
+// returns the height in blocks
+double heightCurve(double val, int x, int y)
+{
+	if(heightFalloff) val *= falloff(x, y);
+	if(heightValueInvert) val = 1.0f - val;
+	double height = pow(val, heightExponent);
+	return heightBase + (heightTop - heightBase) * height;
+}
+
+void setHeight(const Window* w, int i, double height)
+{
+	w->top[i] = height;
+	w->fraction[i] = (height - w->top[i]) * 3.0 + 1.0;
+	w->bottom[i] = w->top[i] - bottomMinThick;
+}
+
+void topRect(const Window* w, const octave_noise_2d_setup* noise, Rect r)
+{
+	if(heightGraph.count)
+	{
+		topGraphRect(w, r);
+		return;
+	}
+	if(adaptiveBound > 0.0)
+	{
+		int width = r.x1 - r.x0;
+		double* value = (double*)scratchAlloc(width * (r.y1 - r.y0) * sizeof(double));
+		adaptiveNoiseRect(noise, heightScale, r, w, value);
+		for(int y = r.y0; y < r.y1; ++y)
+		{
+			for(int x = r.x0; x < r.x1; ++x)
+			{
+				int i = w->at(x, y);
+				if(w->material[i] == 0) continue;
+				setHeight(w, i, heightCurve(value[(y - r.y0) * width + x - r.x0] * 0.5 + 0.5, x, y));
+			}
+		}
+		adaptiveCells += width * (r.y1 - r.y0);
+		scratchRelease(value, width * (r.y1 - r.y0) * sizeof(double));
+		return;
+	}
+	NoiseLayer* layers[LAYER_MAX];
+	int cached = fieldLayers(LAYER_HEIGHT, heightSeed, heightScale, noise, layers);
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			int i = w->at(x, y);
+			if(w->material[i] == 0) continue;
+			double nx = (x - 512) * heightScale / 1024;
+			double ny = (y - 512) * heightScale / 1024;
+			double val = (cached ? layerOctaveNoise(layers, noise, x, y, nx, ny) : octave_noise_2d(noise, nx, ny)) * 0.5 + 0.5;
+			setHeight(w, i, heightCurve(val, x, y));
+		}
+	}
+}
+
+// top layer for the land boxes of the occupancy index
+void topLand(const Window* w, const octave_noise_2d_setup* noise)
+{
+	for(int ty = 0; ty < OCC_TILES; ++ty)
+	{
+		for(int tx = 0; tx < OCC_TILES; ++tx)
+		{
+			const TileInfo* t = &occupancy[ty][tx];
+			if(t->flags == TILE_EMPTY) continue;
+			Rect r = {t->x0, t->y0, t->x1, t->y1};
+			topRect(w, noise, r);
+		}
+	}
+}
+
+void generateTop()
+{
+	printf("generating island top layer: ");
+	init_noise(heightSeed);
+	octave_noise_2d_setup noise;
+	init_octave_noise_2d(&noise, heightOctaves, heightOctavePersistence, heightOctaveScale);
+	Window w = fullWindow();
+	topLand(&w, &noise);
+	printf(" done.\n");
+}
+
+// marks cells whose four neighbors are grass as well, cells on the map border never are
+void erodeRect(const Window* w, Rect r)
+{
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			int i = w->at(x, y);
+			if (  (x > 0 && x < 1023 && y > 0 && y < 1023)
+			   && (w->material[i] == GRASS)
+			   && (w->material[w->at(x, y - 1)] == GRASS)
+			   && (w->material[w->at(x, y + 1)] == GRASS)
+			   && (w->material[w->at(x - 1, y)] == GRASS)
+			   && (w->material[w->at(x + 1, y)] == GRASS)
+			   )
+			{
+				w->temp[i] = 1;
+			}
+			else
+			{
+				w->temp[i] = 0;
+			}
+		}
+	}
+}
+
+// first pass lowers the outer rim by a block, second pass the next ring by a third
+void roundRect(const Window* w, Rect r, int pass)
+{
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			int i = w->at(x, y);
+			if(w->material[i] == GRASS && w->temp[i] == 0)
+			{
+				w->material[i] = DIRT;
+				if(pass == 2)
+				{
+					w->fraction[i] -= 1;
+					if(w->fraction[i] != 0) continue;
+					w->fraction[i] = 3;
+				}
+				w->top[i] -= 1;
+				w->bottom[i] = w->top[i] - bottomMinThick;
+			}
+		}
+	}
+}
+
+// ocean cells are neither eroded nor rounded, so the passes only visit the land boxes
+void erodeBox(Rect r)
+{
+	Window w = fullWindow();
+	erodeRect(&w, r);
+}
+
+void roundBox1(Rect r)
+{
+	Window w = fullWindow();
+	roundRect(&w, r, 1);
+}
+
+void roundBox2(Rect r)
+{
+	Window w = fullWindow();
+	roundRect(&w, r, 2);
+}
+
+void roundEdges()
+{
+	printf("rounding edges: ");
+	forEachLandBox(erodeBox);
+	forEachLandBox(roundBox1);
+	forEachLandBox(erodeBox);
+	forEachLandBox(roundBox2);
+	printf(" done.\n");
+}
+
+// shrinks a rectangle by one cell on every side that is not on the map border
+Rect shrinkRect(Rect r)
+{
+	Rect s = {(r.x0 > 0) ? r.x0 + 1 : 0, (r.y0 > 0) ? r.y0 + 1 : 0, (r.x1 < 1024) ? r.x1 - 1 : 1024, (r.y1 < 1024) ? r.y1 - 1 : 1024};
+	return s;
+}
+
+#define TILE_SIZE 128
+#define TILE_HALO 2
+
+// island, top and roundEdges for one tile at a time in local planes that stay in
+// cache; the two erode passes need a halo of two cells which is computed twice
+void generateTiled()
+{
+	printf("generating terrain in tiles: ");
+	const int tileCells = (TILE_SIZE + 2 * TILE_HALO) * (TILE_SIZE + 2 * TILE_HALO);
+	const size_t tileBytes = tileCells * 5;
+	unsigned char* tiles = (unsigned char*)scratchAlloc(tileBytes);
+	unsigned char* tMaterial = tiles;
+	unsigned char* tTop = tMaterial + tileCells;
+	unsigned char* tFraction = tTop + tileCells;
+	unsigned char* tBottom = tFraction + tileCells;
+	unsigned char* tTemp = tBottom + tileCells;
+
+	octave_noise_2d_setup islandNoise;
+	octave_noise_2d_setup heightNoise;
+	init_octave_noise_2d(&islandNoise, islandOctaves, islandOctavePersistence, islandOctaveScale);
+	init_octave_noise_2d(&heightNoise, heightOctaves, heightOctavePersistence, heightOctaveScale);
+
+	for(int ty = 0; ty < 1024; ty += TILE_SIZE)
+	{
+		for(int tx = 0; tx < 1024; tx += TILE_SIZE)
+		{
+			Rect t = {tx, ty, tx + TILE_SIZE, ty + TILE_SIZE};
+			Rect r = {MAX(tx - TILE_HALO, 0), MAX(ty - TILE_HALO, 0), MIN(t.x1 + TILE_HALO, 1024), MIN(t.y1 + TILE_HALO, 1024)};
+			Window w = {r, r.x1 - r.x0, tMaterial, tTop, tFraction, tBottom, tTemp};
+			memset(tiles, 0, tileBytes);
+
+			init_noise(islandSeed);
+			islandRect(&w, &islandNoise, r);
+			init_noise(heightSeed);
+			topRect(&w, &heightNoise, r);
+
+			Rect r1 = shrinkRect(r);
+			erodeRect(&w, r1);
+			roundRect(&w, r1, 1);
+			erodeRect(&w, t);
+			roundRect(&w, t, 2);
+
+			for(int y = t.y0; y < t.y1; ++y)
+			{
+				int i = w.at(t.x0, y);
+				for(int x = t.x0; x < t.x1; ++x, ++i)
+				{
+					material[cell(x, y)] = w.material[i];
+					top[cell(x, y)] = w.top[i];
+					fraction[cell(x, y)] = w.fraction[i];
+					bottom[cell(x, y)] = w.bottom[i];
+				}
+			}
+		}
+	}
+	scratchRelease(tiles, tileBytes);
+	buildOccupancy();
+	printf(" done.\n");
+}
+
+// one thermal erosion step on rows [y0, y1) from erosion[src] to erosion[1 - src]
+// heights are in 1/48 of a block ((top * 3 + fraction - 1) * 16), material moves
+// pairwise between 4-neighbor land cells by 1/8 of the height difference above
+// the talus, so every cell only reads its neighbors and mass is conserved
+void erodeThermalRows(int src, int y0, int y1, int talus)
+{
+	for(int y = y0; y < y1; ++y)
+	{
+		const short* in = erosion[src];
+		short* out = erosion[1 - src];
+		for(int x = 1; x < 1023; ++x)
+		{
+			int c = cell(x, y);
+			int h = in[c];
+			int nc[4] = { cell(x, y - 1), cell(x, y + 1), cell(x - 1, y), cell(x + 1, y) };
+			int n[4] = { in[nc[0]], in[nc[1]], in[nc[2]], in[nc[3]] };
+			int l[4] = { material[nc[0]], material[nc[1]], material[nc[2]], material[nc[3]] };
+			int sum = 0;
+			for(int k = 0; k < 4; ++k)
+			{
+				int d = n[k] - h;
+				int e = (d < 0 ? -d : d) - talus;
+				e = (e > 0 ? e : 0) >> 3;
+				e = (d < 0) ? -e : e;
+				sum += (l[k] != 0) ? e : 0;
+			}
+			out[c] = (material[c] != 0) ? h + sum : h;
+		}
+	}
+}
+
+// erosion workers, started once per stage: each one owns a band of inner rows and
+// does one step whenever erosionStep advances, the stage waits until all are done
+struct ErosionPool
+{
+	std::mutex              lock;
+	std::condition_variable changed;
+	int                     step;
+	int                     done;
+	int                     src;
+	int                     stop;
+};
+
+ErosionPool erosionPool;
+
+void erosionWorker(int y0, int y1, int talus)
+{
+	int step = 0;
+	for(;;)
+	{
+		int src;
+		{
+			std::unique_lock<std::mutex> guard(erosionPool.lock);
+			while(!erosionPool.stop && erosionPool.step == step) erosionPool.changed.wait(guard);
+			if(erosionPool.stop) return;
+			step = erosionPool.step;
+			src = erosionPool.src;
+		}
+		erodeThermalRows(src, y0, y1, talus);
+		{
+			std::lock_guard<std::mutex> guard(erosionPool.lock);
+			erosionPool.done++;
+		}
+		erosionPool.changed.notify_all();
+	}
+}
+
+void erodeThermal()
+{
+	if(erosionIterations <= 0) return;
+	printf("thermal erosion: ");
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int talus = erosionTalus * 48.0 + 0.5;
+
+	for(int y = 0; y < 1024; ++y)
+	{
+		for(int x = 0; x < 1024; ++x)
+		{
+			erosion[0][cell(x, y)] = erosion[1][cell(x, y)] = (top[cell(x, y)] * 3 + fraction[cell(x, y)] - 1) * 16;
+		}
+	}
+
+	// the inner rows are split in one band per thread, the buffers swap after each step
+	std::thread pool[256];
+	int n = MIN(threads, 256);
+	erosionPool.step = erosionPool.done = erosionPool.src = erosionPool.stop = 0;
+	if(n > 1)
+	{
+		for(int t = 0; t < n; ++t) pool[t] = std::thread(erosionWorker, 1 + 1022 * t / n, 1 + 1022 * (t + 1) / n, talus);
+	}
+
+	int src = 0;
+	int i;
+	for(i = 0; i < erosionIterations; ++i)
+	{
+		if(erosionBudget > 0)
+		{
+			long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			if(ms >= erosionBudget) break;
+		}
+		if(pastDeadline())
+		{
+			degrade(STAGE_EROSION);
+			break;
+		}
+
+		if(n > 1)
+		{
+			std::unique_lock<std::mutex> guard(erosionPool.lock);
+			erosionPool.src = src;
+			erosionPool.done = 0;
+			erosionPool.step++;
+			erosionPool.changed.notify_all();
+			while(erosionPool.done < n) erosionPool.changed.wait(guard);
+		}
+		else erodeThermalRows(src, 1, 1023, talus);
+		src = 1 - src;
+	}
+
+	if(n > 1)
+	{
+		{
+			std::lock_guard<std::mutex> guard(erosionPool.lock);
+			erosionPool.stop = 1;
+		}
+		erosionPool.changed.notify_all();
+		for(int t = 0; t < n; ++t) pool[t].join();
+	}
+
+	for(int y = 0; y < 1024; ++y)
+	{
+		for(int x = 0; x < 1024; ++x)
+		{
+			if(material[cell(x, y)] == 0) continue;
+			int h = (erosion[src][cell(x, y)] + 8) >> 4;
+			h = LIMIT(h, 0, 767);
+			top[cell(x, y)] = h / 3;
+			fraction[cell(x, y)] = h % 3 + 1;
+			bottom[cell(x, y)] = top[cell(x, y)] - bottomMinThick;
+		}
+	}
+
+	if(i < erosionIterations) printf("\ntime budget exhausted after %d iterations\n", i);
+	printf(" done.\n");
+}
+
+void copyBottomBox(Rect r)
+{
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		for(int x = r.x0; x < r.x1; ++x) bottom[cell(x, y)] = temp[cell(x, y)];
+	}
+}
+
+// One smoothing step of the bottom for the cells [x0, x1) of row y: temp gets the
+// highest neighbor minus 1 where that is below the bottom, else the bottom, and
+// lower[] marks the cells generateBottom lowers by a random amount (the ones that
+// took a neighbor value and the ones with the same thickness as all 4 neighbors).
+// With rows the neighbors are at -1, +1, -1024, +1024 and 16 (SSE2) or 32 (AVX2)
+// cells are done at once with byte instructions, the subtractions wrap like the
+// unsigned char arithmetic of the scalar cells. Neighbor thickness is compared as
+// int there, so a neighbor whose top is below its bottom never matches.
+#if PLANE_LAYOUT == 0 && defined(__AVX2__)
+#define BOTTOM_LANES 32
+#elif PLANE_LAYOUT == 0 && defined(__SSE2__)
+#define BOTTOM_LANES 16
+#else
+#define BOTTOM_LANES 1
+#endif
+
+static inline int bottomCell(int x, int y)
+{
+	unsigned char max = 0;
+	if((unsigned char)(bottom[cell(x, y-1)] - 1) > max) max = (unsigned char)(bottom[cell(x, y-1)] - 1);
+	if((unsigned char)(bottom[cell(x, y+1)] - 1) > max) max = (unsigned char)(bottom[cell(x, y+1)] - 1);
+	if((unsigned char)(bottom[cell(x-1, y)] - 1) > max) max = (unsigned char)(bottom[cell(x-1, y)] - 1);
+	if((unsigned char)(bottom[cell(x+1, y)] - 1) > max) max = (unsigned char)(bottom[cell(x+1, y)] - 1);
+
+	if(max < bottom[cell(x, y)])
+	{
+		temp[cell(x, y)] = max;
+		return 1;
+	}
+	temp[cell(x, y)] = bottom[cell(x, y)];
+	if(bottom[cell(x, y)] == 0) return 0;
+	unsigned char thickness = top[cell(x, y)] - bottom[cell(x, y)];
+	if(top[cell(x, y-1)] - bottom[cell(x, y-1)] != thickness) return 0;
+	if(top[cell(x, y+1)] - bottom[cell(x, y+1)] != thickness) return 0;
+	if(top[cell(x-1, y)] - bottom[cell(x-1, y)] != thickness) return 0;
+	if(top[cell(x+1, y)] - bottom[cell(x+1, y)] != thickness) return 0;
+	return 1;
+}
+
+void bottomSpan(int y, int x0, int x1, unsigned char* lower)
+{
+	int x = x0;
+	#if BOTTOM_LANES == 32
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i zero = _mm256_setzero_si256();
+	for(; x + 32 <= x1; x += 32)
+	{
+		const unsigned char* b = bottom + cell(x, y);
+		const unsigned char* t = top + cell(x, y);
+		__m256i bc = _mm256_loadu_si256((const __m256i*)b);
+		__m256i bn[4] = {_mm256_loadu_si256((const __m256i*)(b - 1024)), _mm256_loadu_si256((const __m256i*)(b + 1024)),
+		                 _mm256_loadu_si256((const __m256i*)(b - 1)), _mm256_loadu_si256((const __m256i*)(b + 1))};
+		__m256i tn[4] = {_mm256_loadu_si256((const __m256i*)(t - 1024)), _mm256_loadu_si256((const __m256i*)(t + 1024)),
+		                 _mm256_loadu_si256((const __m256i*)(t - 1)), _mm256_loadu_si256((const __m256i*)(t + 1))};
+		__m256i max = zero;
+		for(int k = 0; k < 4; ++k) max = _mm256_max_epu8(max, _mm256_sub_epi8(bn[k], one));
+		// max >= bottom keeps the bottom, else the neighbor value is taken and lowered
+		__m256i keep = _mm256_cmpeq_epi8(_mm256_max_epu8(max, bc), max);
+		__m256i value = _mm256_blendv_epi8(max, bc, keep);
+		__m256i thickness = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)t), bc);
+		__m256i same = _mm256_andnot_si256(_mm256_cmpeq_epi8(bc, zero), keep);
+		for(int k = 0; k < 4; ++k)
+		{
+			same = _mm256_and_si256(same, _mm256_cmpeq_epi8(_mm256_sub_epi8(tn[k], bn[k]), thickness));
+			same = _mm256_and_si256(same, _mm256_cmpeq_epi8(_mm256_max_epu8(tn[k], bn[k]), tn[k]));
+		}
+		__m256i mask = _mm256_or_si256(_mm256_andnot_si256(keep, _mm256_set1_epi8(-1)), same);
+		_mm256_storeu_si256((__m256i*)(temp + cell(x, y)), value);
+		_mm256_storeu_si256((__m256i*)(lower + x - x0), _mm256_and_si256(mask, one));
+	}
+	#elif BOTTOM_LANES == 16
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i zero = _mm_setzero_si128();
+	for(; x + 16 <= x1; x += 16)
+	{
+		const unsigned char* b = bottom + cell(x, y);
+		const unsigned char* t = top + cell(x, y);
+		__m128i bc = _mm_loadu_si128((const __m128i*)b);
+		__m128i bn[4] = {_mm_loadu_si128((const __m128i*)(b - 1024)), _mm_loadu_si128((const __m128i*)(b + 1024)),
+		                 _mm_loadu_si128((const __m128i*)(b - 1)), _mm_loadu_si128((const __m128i*)(b + 1))};
+		__m128i tn[4] = {_mm_loadu_si128((const __m128i*)(t - 1024)), _mm_loadu_si128((const __m128i*)(t + 1024)),
+		                 _mm_loadu_si128((const __m128i*)(t - 1)), _mm_loadu_si128((const __m128i*)(t + 1))};
+		__m128i max = zero;
+		for(int k = 0; k < 4; ++k) max = _mm_max_epu8(max, _mm_sub_epi8(bn[k], one));
+		// max >= bottom keeps the bottom, else the neighbor value is taken and lowered
+		__m128i keep = _mm_cmpeq_epi8(_mm_max_epu8(max, bc), max);
+		__m128i value = _mm_or_si128(_mm_and_si128(keep, bc), _mm_andnot_si128(keep, max));
+		__m128i thickness = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)t), bc);
+		__m128i same = _mm_andnot_si128(_mm_cmpeq_epi8(bc, zero), keep);
+		for(int k = 0; k < 4; ++k)
+		{
+			same = _mm_and_si128(same, _mm_cmpeq_epi8(_mm_sub_epi8(tn[k], bn[k]), thickness));
+			same = _mm_and_si128(same, _mm_cmpeq_epi8(_mm_max_epu8(tn[k], bn[k]), tn[k]));
+		}
+		__m128i mask = _mm_or_si128(_mm_andnot_si128(keep, _mm_set1_epi8(-1)), same);
+		_mm_storeu_si128((__m128i*)(temp + cell(x, y)), value);
+		_mm_storeu_si128((__m128i*)(lower + x - x0), _mm_and_si128(mask, one));
+	}
+	#endif
+	for(; x < x1; ++x) lower[x - x0] = bottomCell(x, y);
+}
+
+void generateBottom()
+{
+	printf("generating bottom: ");
+	srand(bottomSeed);
+	for(;;)
+	{
+		// only cells inside the land bounding boxes can change, the others stay 0,
+		// visiting them row by row keeps the order of rand() calls
+		int i = 0;
+		for(int y = 0; y < 1024; ++y)
+		{
+			for(int tx = 0; tx < OCC_TILES; ++tx)
+			{
+				const TileInfo* t = &occupancy[y / OCC_TILE][tx];
+				if(t->flags == TILE_EMPTY || y < t->y0 || y >= t->y1) continue;
+				// the byte kernel decides which cells are lowered, rand() is then drawn
+				// for them in order
+				unsigned char lower[1024];
+				bottomSpan(y, t->x0, t->x1, lower);
+				for(int x = t->x0; x < t->x1; ++x)
+				{
+					if(!lower[x - t->x0]) continue;
+					temp[cell(x, y)] -= (1.0 + bottomAdd) * rand() / ((long)RAND_MAX + 1);
+					i++;
+				}
+			}
+		}
+		forEachLandBox(copyBottomBox);
+		if(i == 0) break;
+		if(pastDeadline())
+		{
+			degrade(STAGE_BOTTOM);
+			printf("\ndeadline reached, bottom not fully smoothed\n");
+			break;
+		}
+	}
+	printf(" done.\n");
+}
+
+// caves
+//
+// A 3D noise field carves blocks out of the solid band [bottom, top) of every
+// land column, keeping -vm blocks at both ends so the surface and the underside
+// stay closed. Only the land boxes of the occupancy index are visited and each
+// column is evaluated along z in one call. The carved blocks are kept as runs,
+// ((z << 20) + (y << 10) + x, length), the same position encoding as the trees.
+
+unsigned int* volumeRuns;
+int           volumeRunCount;
+int           volumeRunCapacity;
+long          volumeCarved;
+
+void addVolumeRun(int x, int y, int z, int length)
+{
+	if(volumeRunCount == volumeRunCapacity)
+	{
+		volumeRunCapacity = volumeRunCapacity ? 2 * volumeRunCapacity : 65536;
+		volumeRuns = (unsigned int*)realloc(volumeRuns, volumeRunCapacity * 8);
+		if(!volumeRuns)
+		{
+			printf("Could not allocate cave runs, aborting\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	volumeRuns[2 * volumeRunCount] = (z << 20) + (y << 10) + x;
+	volumeRuns[2 * volumeRunCount + 1] = length;
+	volumeRunCount++;
+	volumeCarved += length;
+}
+
+const octave_noise_2d_setup* volumeNoise;
+
+void carveBox(Rect r)
+{
+	unsigned char above[256];
+	// land boxes lie within one region
+	if(!regionWanted((r.y0 / 256) * 8 + r.x0 / 256)) return;
+	if(degradedStages & (1u << STAGE_VOLUME)) return;
+	if(pastDeadline())
+	{
+		degrade(STAGE_VOLUME);
+		return;
+	}
+	for(int y = r.y0; y < r.y1; ++y)
+	{
+		for(int x = r.x0; x < r.x1; ++x)
+		{
+			if(material[cell(x, y)] == 0) continue;
+			int z0 = bottom[cell(x, y)] + volumeMargin;
+			int z1 = top[cell(x, y)] - volumeMargin;
+			if(z1 <= z0) continue;
+			octave_noise_3d_column(volumeNoise, (x - 512) * volumeScale / 1024, (y - 512) * volumeScale / 1024,
+			                       z0 * volumeScale / 1024, volumeScale / 1024, z1 - z0, volumeThreshold * 2.0 - 1.0, above);
+			for(int z = z0; z < z1; ++z)
+			{
+				if(!above[z - z0]) continue;
+				int start = z;
+				while(z < z1 && above[z - z0]) ++z;
+				addVolumeRun(x, y, start, z - start);
+			}
+		}
+	}
+}
+
+void carveVolume()
+{
+	volumeRunCount = 0;
+	volumeCarved = 0;
+	if(volumeThreshold >= 1.0) return;
+	printf("carving caves: ");
+	init_noise(volumeSeed);
+	octave_noise_2d_setup noise;
+	init_octave_noise_2d(&noise, volumeOctaves, volumeOctavePersistence, volumeOctaveScale);
+	volumeNoise = &noise;
+	forEachLandBox(carveBox);
+	printf(" %ld blocks in %d runs, done.\n", volumeCarved, volumeRunCount);
+}
+
+// candidates of plantTrees are drawn TREE_BATCH at a time, so the tree graph is
+// evaluated once per batch instead of once per cell
+#define TREE_BATCH 256
+
+// draws the next TREE_BATCH candidate cells in the order plantTrees takes them
+// and evaluates the tree graph for the ones on grass; planting only turns grass
+// into dirt, so every candidate that is still grass when it is taken has its value
+void drawTreeBatch(int* x, int* y, double* value)
+{
+	int gx[TREE_BATCH];
+	int gy[TREE_BATCH];
+	int index[TREE_BATCH];
+	double gv[TREE_BATCH];
+	int n = 0;
+	for(int k = 0; k < TREE_BATCH; ++k)
+	{
+		x[k] = rand() % 1024;
+		y[k] = rand() % 1024;
+		value[k] = 0.0;
+		if(treeGraph.count && material[cell(x[k], y[k])] == GRASS)
+		{
+			gx[n] = x[k];
+			gy[n] = y[k];
+			index[n++] = k;
+		}
+	}
+	if(!n) return;
+	evaluateGraphCells(&treeGraph, gx, gy, n, gv);
+	for(int k = 0; k < n; ++k) value[index[k]] = gv[k];
+}
+
+void plantTrees()
+{
+	printf("planting trees: ");
+	init_noise(treeSeed);
+	octave_noise_2d_setup noise;
+	init_octave_noise_2d(&noise, treeOctaves, treeOctavePersistence, treeOctaveScale);
+	srand(treeSeedPos);
+	int batchX[TREE_BATCH];
+	int batchY[TREE_BATCH];
+	double batchValue[TREE_BATCH];
+	int next = TREE_BATCH;
+	int i = 0;
+	int j = 0;
+	while(occupiedTiles && i < treeNumber)
+	{
+		if(j++ > 1024 * 1024 * 8) break;
+		if((j & 4095) == 0 && pastDeadline())
+		{
+			degrade(STAGE_TREES);
+			break;
+		}
+
+		if(next == TREE_BATCH)
+		{
+			drawTreeBatch(batchX, batchY, batchValue);
+			next = 0;
+		}
+		int x = batchX[next];
+		int y = batchY[next];
+		double val = batchValue[next++];
+
+		if(material[cell(x, y)] != GRASS) continue;
+
+		if(!treeGraph.count)
+		{
+			val = scaled_octave_noise_2d(&noise, 0.0, 1.0, (x - 512) * treeScale / 1024, (y - 512) * treeScale / 1024);
+			if(treeFalloff) val *= falloff(x, y);
+			if(treeValueInvert) val = 1.0 - val;
+		}
+		if(val > treeDensity)
+		{
+			trees[i++] = ((top[cell(x, y)] - 1) << 20) + (y << 10) + x;
+			material[cell(x, y)] = DIRT;
+		}
+	}
+	if(i < treeNumber)
+	{
+		printf("\ncould only plant %d trees\n", i);
+		treeNumber = i;
+	}
+	printf(" done.\n");
+}
+
+void growCrystals()
+{
+	printf("growing crystals: ");
+	srand(crystalSeed);
+	int i = 0;
+	int j = 0;
+	while(occupiedTiles && i < crystalNumber)
+	{
+		if(j++ > 1024 * 1024 * 8) break;
+		if((j & 4095) == 0 && pastDeadline())
+		{
+			degrade(STAGE_CRYSTALS);
+			break;
+		}
+		int x = (rand() % (1022 - 2 * crystalGrassRadius)) + crystalGrassRadius + 1;
+		int y = (rand() % (1022 - 2 * crystalGrassRadius)) + crystalGrassRadius + 1;
+
+		if(material[cell(x, y)] != GRASS) continue;
+
+		unsigned char isOK = 1;
+		for(int j = 0; isOK && j < i; j++)
+		{
+			int dx = crystals[j] % 1024 - x;
+			int dy = (crystals[j] >> 10) % 1024 - y;
+			if(dx * dx + dy * dy < crystalDistance * crystalDistance) isOK = 0;
+		}
+		if(!isOK) continue;
+
+		// height differences at r and r / 2 in the 4 directions, the candidates keep
+		// r + 1 cells from the border so the probes stay on the map
+		int r = crystalGrassRadius;
+		int h = r / 2;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x, y - r)]) / r) > crystalMaxSlope) isOK = 0;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x, y + r)]) / r) > crystalMaxSlope) isOK = 0;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x - r, y)]) / r) > crystalMaxSlope) isOK = 0;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x + r, y)]) / r) > crystalMaxSlope) isOK = 0;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x, y - h)]) / h) > crystalMaxSlope) isOK = 0;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x, y + h)]) / h) > crystalMaxSlope) isOK = 0;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x - h, y)]) / h) > crystalMaxSlope) isOK = 0;
+		if(fabs((double)(top[cell(x, y)] - top[cell(x + h, y)]) / h) > crystalMaxSlope) isOK = 0;
+		if(!isOK) continue;
+
+		for(int ty = y - crystalGrassRadius; isOK && ty < y + crystalGrassRadius; ++ty)
+		{
+			for(int tx = x - crystalGrassRadius; isOK && tx < x + crystalGrassRadius; ++tx)
+			{
+				int dx = tx - x;
+				int dy = ty - y;
+				if(dx * dx + dy * dy <= crystalGrassRadius * crystalGrassRadius && material[cell(tx, ty)] != GRASS) isOK = 0;
+			}
+		}
+		if(!isOK) continue;
+
+		crystals[i] = ((top[cell(x, y)] - 1) << 20) + (y << 10) + x;
+		i++;
+	}
+
+	if(i < crystalNumber)
+	{
+		printf("\ncould only grow %d crystals\n", i);
+		crystalNumber = i;
+	}
+
+	if(crystalNumber)
+	{
+		double angle = 2 * M_PI * rand() / ((long)RAND_MAX + 1);
+		int dx = cos(angle) * crystalStartPointDistance;
+		int dy = sin(angle) * crystalStartPointDistance;
+		int x = crystals[0] % 1024 + dx;
+		int y = (crystals[0] >> 10) % 1024 + dy;
+		startPoint = ((top[cell(x, y)] - 1) << 20) + (y << 10) + x;
+		startPointValid = (x >= 0 && x < 1024 && y >= 0 && y < 1024 && material[cell(x, y)] != 0);
+	}
+	else
+	{
+		startPointValid = 0;
+		printf("warning: no crystals, start point will be invalid\n");
+	}
+
+	printf(" done.\n");
+}
+
+// compares adaptive and full evaluation of the island and height fields on
+// separate planes and prints mismatches, errors and timings (-aq)
+void adaptiveReport()
+{
+	unsigned char* planes[2][5];
+	Window w[2];
+	for(int k = 0; k < 2; ++k)
+	{
+		for(int p = 0; p < 5; ++p) planes[k][p] = new unsigned char[1024 * 1024]();
+		Window v = {fullRect, 1024, planes[k][0], planes[k][1], planes[k][2], planes[k][3], planes[k][4]};
+		w[k] = v;
+	}
+
+	octave_noise_2d_setup islandNoise;
+	octave_noise_2d_setup heightNoise;
+	init_octave_noise_2d(&islandNoise, islandOctaves, islandOctavePersistence, islandOctaveScale);
+	init_octave_noise_2d(&heightNoise, heightOctaves, heightOctavePersistence, heightOctaveScale);
+
+	double bound = adaptiveBound;
+	double seconds[2][2];
+	for(int k = 0; k < 2; ++k)
+	{
+		// k = 0 full evaluation, k = 1 adaptive
+		adaptiveBound = k ? bound : 0.0;
+		adaptiveCells = adaptiveExactCells = 0;
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		init_noise(islandSeed);
+		islandRect(&w[k], &islandNoise, fullRect);
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+		init_noise(heightSeed);
+		topLand(&w[k], &heightNoise);
+		std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+		seconds[k][0] = std::chrono::duration<double>(t1 - t0).count();
+		seconds[k][1] = std::chrono::duration<double>(t2 - t1).count();
+	}
+	adaptiveBound = bound;
+
+	long maskDiff = 0;
+	long land = 0;
+	long heightDiff = 0;
+	int maxHeightDiff = 0;
+	for(int i = 0; i < 1024 * 1024; ++i)
+	{
+		if(w[0].material[i] != w[1].material[i]) maskDiff++;
+		if(w[0].material[i] == 0 || w[1].material[i] == 0) continue;
+		land++;
+		int d = abs((w[0].top[i] * 3 + w[0].fraction[i]) - (w[1].top[i] * 3 + w[1].fraction[i]));
+		if(d) heightDiff++;
+		maxHeightDiff = MAX(maxHeightDiff, d);
+	}
+
+	printf("adaptive sampling report (bound %lf):\n", bound);
+	for(int o = 0; o < islandOctaves; ++o)
+	{
+		double e;
+		printf("island octave %d: grid spacing %d\n", o, adaptiveStep(&islandNoise, islandScale, o, &e));
+	}
+	for(int o = 0; o < heightOctaves; ++o)
+	{
+		double e;
+		printf("height octave %d: grid spacing %d\n", o, adaptiveStep(&heightNoise, heightScale, o, &e));
+	}
+	printf("island: %ld cells evaluated exactly near the edge, %ld mask differences\n", adaptiveExactCells, maskDiff);
+	printf("height: %ld of %ld land cells differ, by at most %d thirds of a block\n", heightDiff, land, maxHeightDiff);
+	printf("time island: full %.3lf s, adaptive %.3lf s\n", seconds[0][0], seconds[1][0]);
+	printf("time height: full %.3lf s, adaptive %.3lf s\n", seconds[0][1], seconds[1][1]);
+
+	for(int k = 0; k < 2; ++k)
+	{
+		for(int p = 0; p < 5; ++p) delete[] planes[k][p];
+	}
+}
+
+void checkError(FILE* out, char* fname)
+{
+	if(!out)
+	{
+		printf("Could not open %s, aborting", fname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+void writePGM(char* fname, unsigned char* data, int width, int height)
+{
+	FILE* out = fopen(fname, "wb");
+	checkError(out, fname);
+	fprintf(out, "P5\n%d %d\n255\n", width, height);
+	fwrite(data, 1, width*height, out);
+	fclose(out);
+}
+
+// a plane as pgm image, in row order whatever the plane layout
+void writePlanePGM(const char* name, const unsigned char* plane)
+{
+	char fname[600];
+	snprintf(fname, sizeof(fname), "%s/%s", outputDir, name);
+	#if PLANE_LAYOUT == 0
+	writePGM(fname, (unsigned char*)plane, 1024, 1024);
+	#else
+	unsigned char* rows = (unsigned char*)malloc(1024 * 1024);
+	for(int y = 0; y < 1024; ++y)
+	{
+		for(int x = 0; x < 1024; ++x) rows[y * 1024 + x] = plane[cell(x, y)];
+	}
+	writePGM(fname, rows, 1024, 1024);
+	free(rows);
+	#endif
+}
+
+void writePGMs()
+{
+	writePlanePGM("mat.pgm", material);
+	writePlanePGM("top.pgm", top);
+	writePlanePGM("fra.pgm", fraction);
+	writePlanePGM("bot.pgm", bottom);
+}
+
+// appends printf formatted text to buf
+void appendf(char* buf, size_t size, const char* format, ...)
+{
+	size_t n = strlen(buf);
+	if(n + 1 >= size) return;
+	va_list args;
+	va_start(args, format);
+	vsnprintf(buf + n, size - n, format, args);
+	va_end(args);
+}
+
+void formatInfo(char* buf, size_t size)
+{
+	buf[0] = 0;
+	appendf(buf, size, "Generated with csworldgen %s (https://github.com/Draradech/csworldgen)\n", version);
+	appendf(buf, size, "\n");
+	appendf(buf, size, "generation parameters:\n");
+	appendf(buf, size, "-i %d -is %lf -io %d -ios %lf -iop %lf ", islandSeed, islandScale, islandOctaves, islandOctaveScale, islandOctavePersistence);
+	appendf(buf, size, "-ie %lf -iz %lf -id %lf ", islandEdge, islandSize, islandDensity);
+	appendf(buf, size, "-h %d -hs %lf -ho %d -hos %lf -hop %lf ", heightSeed, heightScale, heightOctaves, heightOctaveScale, heightOctavePersistence);
+	appendf(buf, size, "-hb %lf -ht %lf -he %lf -hi %d -hf %d ", heightBase, heightTop, heightExponent, heightValueInvert, heightFalloff);
+	appendf(buf, size, "-b %d -ba %lf -bm %d ", bottomSeed, bottomAdd, bottomMinThick);
+	appendf(buf, size, "-t %d -ts %lf -to %d -tos %lf -top %lf ", treeSeed, treeScale, treeOctaves, treeOctaveScale, treeOctavePersistence);
+	appendf(buf, size, "-tp %d -tn %d -td %lf -ti %d -tf %d ", treeSeedPos, treeNumber, treeDensity, treeValueInvert, treeFalloff);
+	appendf(buf, size, "-c %d -cr %d -cn %d -cd %d -cs %lf -csd %lf ", crystalSeed, crystalGrassRadius, crystalNumber, crystalDistance, crystalMaxSlope, crystalStartPointDistance);
+	// the cave seed is drawn at random when not given, listing it without caves
+	// would make every rerun of an unchanged world differ
+	if(volumeThreshold < 1.0) appendf(buf, size, "-v %d ", volumeSeed);
+	appendf(buf, size, "-vs %lf -vo %d -vos %lf -vop %lf -vt %lf -vm %d ", volumeScale, volumeOctaves, volumeOctaveScale, volumeOctavePersistence, volumeThreshold, volumeMargin);
+	appendf(buf, size, "-e %d -et %lf -eb %d -ae %lf\n", erosionIterations, erosionTalus, erosionBudget, adaptiveBound);
+	if(islandGraph.count || heightGraph.count || treeGraph.count)
+	{
+		appendf(buf, size, "\n");
+		appendf(buf, size, "noise graph:\n");
+		if(islandGraph.count) appendf(buf, size, "island = %s\n", islandGraph.source);
+		if(heightGraph.count) appendf(buf, size, "height = %s\n", heightGraph.source);
+		if(treeGraph.count) appendf(buf, size, "trees = %s\n", treeGraph.source);
+	}
+	if(deadlineMs)
+	{
+		appendf(buf, size, "\n");
+		appendf(buf, size, "deadline %d ms, stages stopped early:", deadlineMs);
+		const char* names[STAGE_COUNT] = {"island", "top", "erosion", "bottom", "caves", "trees", "crystals"};
+		for(int stage = 0; stage < STAGE_COUNT; ++stage)
+		{
+			if(degradedStages & (1u << stage)) appendf(buf, size, " %s", names[stage]);
+		}
+		appendf(buf, size, degradedStages ? "\n" : " none\n");
+	}
+}
+
+// contents of Monde_Doodads in a new buffer (free it), its length in *length;
+// every entry takes at most 20 bytes ("Crystal " and a signed int)
+char* formatDoodads(size_t* length)
+{
+	size_t size = 32 + (size_t)crystalNumber * 20;
+	char* buf = (char*)malloc(size);
+	if(!buf)
+	{
+		printf("Could not allocate the doodads, aborting\n");
+		exit(EXIT_FAILURE);
+	}
+	size_t n = snprintf(buf, size, "StartingPoint %d ", startPoint);
+	for(int i = 0; i < crystalNumber && n < size; ++i)
+	{
+		n += snprintf(buf + n, size - n, "Crystal %d ", crystals[i]);
+	}
+	if(n >= size)
+	{
+		printf("doodads do not fit into %lu bytes, aborting\n", (unsigned long)size);
+		exit(EXIT_FAILURE);
+	}
+	*length = n;
+	return buf;
+}
+
+void writeOutput(const char* name, const void* data, size_t size, const char* mode);
+
 void writeInfoFile()
 {
-	char fname[512];
-	sprintf(fname, "%s/csworldgen.info", outputDir);
+	char info[4096];
+	formatInfo(info, sizeof(info));
+	writeOutput("csworldgen.info", info, strlen(info), "w");
+}
+
+// contents of the region file Monde_i: 2 zero bytes, then bottom, top, material
+// and fraction of every cell in row order
+void buildRegion(int i, unsigned char* out)
+{
+	out[0] = out[1] = 0;
+	unsigned char* c = out + 2;
+	for(int y = (i / 8) * 256; y < ((i / 8) + 1) * 256; ++y)
+	{
+		for(int x = (i % 8) * 256; x < ((i % 8) + 1) * 256; ++x)
+		{
+			*c++ = bottom[cell(x, y)];
+			*c++ = top[cell(x, y)];
+			*c++ = material[cell(x, y)];
+			*c++ = fraction[cell(x, y)];
+		}
+	}
+}
+
+// writes the whole world as one packed container named by -o
+void writePackFile()
+{
+	printf("writing packed world: ");
+	PackContent content;
+	memset(&content, 0, sizeof(content));
+	unsigned char* regions = (unsigned char*)scratchAlloc(PACK_REGIONS * PACK_REGION_SIZE);
+	for(int k = 0; k < PACK_REGIONS; ++k)
+	{
+		int i = packRegionNumber(k);
+		if(regionIsEmpty(i % 8, i / 8) || !regionWanted(i)) continue;
+		buildRegion(i, regions + k * PACK_REGION_SIZE);
+		content.region[k] = regions + k * PACK_REGION_SIZE;
+	}
+	size_t doodadsLength;
+	char* doodads = formatDoodads(&doodadsLength);
+	char info[4096];
+	formatInfo(info, sizeof(info));
+	content.blob[PACK_TREES] = (const unsigned char*)trees;
+	content.blobSize[PACK_TREES] = 4 * treeNumber;
+	content.blob[PACK_DOODADS] = (const unsigned char*)doodads;
+	content.blobSize[PACK_DOODADS] = doodadsLength;
+	if(infoOut)
+	{
+		content.blob[PACK_INFO] = (const unsigned char*)info;
+		content.blobSize[PACK_INFO] = strlen(info);
+	}
+	size_t written;
+	if(writePack(outputDir, &content, packRle, &written))
+	{
+		printf("Could not write %s, aborting\n", outputDir);
+		exit(EXIT_FAILURE);
+	}
+	scratchRelease(regions, PACK_REGIONS * PACK_REGION_SIZE);
+	free(doodads);
+	printf(" %lu bytes, done.\n", (unsigned long)written);
+}
+
+int fileExists(const char* name)
+{
+	struct stat info;
+	return !stat(name, &info);
+}
+
+void makeDirectory(const char* dir)
+{
+	if(!fileExists(dir))
+	{
+		int status;
+		#ifdef _WIN32
+		status = mkdir(dir);
+		#else
+		status = mkdir(dir, 0777);
+		#endif
+		if(status)
+		{
+			printf("Could not create output directory %s, aborting\n", dir);
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+// incremental writing
+//
+// With -inc the world files (not the pgm images) go through writeOutput, which
+// keeps a 64 bit hash, the size and the modification time of what it wrote in
+// csworldgen.hashes. A file whose new content has the hash and size of its entry
+// and that was not touched since is left alone, so its time stamp stays and sync
+// tools skip it. Files without an entry (older worlds) are read once and compared.
+// The manifest is read by beginOutput and written by endOutput, the writers in
+// between run one at a time (writeFiles, or the io thread of runWorldTasks).
+
+#define OUTPUT_FILES 40
+
+
+struct OutputHash
+{
+	char               name[32];
+	unsigned long long hash;
+	long               size;
+	long               mtime;
+};
+
+OutputHash outputHashes[OUTPUT_FILES];
+int        outputHashCount;
+int        outputFiles;      // files of this world, the ones left alone and their bytes
+int        outputKept;
+long       outputKeptBytes;
+
+// FNV-1a over 8 byte words, the tail byte by byte
+unsigned long long contentHash(const void* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	unsigned long long h = 0xcbf29ce484222325ull;
+	size_t i = 0;
+	for(; i + 8 <= size; i += 8)
+	{
+		unsigned long long w;
+		memcpy(&w, p + i, 8);
+		h = (h ^ w) * 0x100000001b3ull;
+	}
+	for(; i < size; ++i) h = (h ^ p[i]) * 0x100000001b3ull;
+	return h;
+}
+
+OutputHash* findOutputHash(const char* name)
+{
+	for(int i = 0; i < outputHashCount; ++i)
+	{
+		if(!strcmp(outputHashes[i].name, name)) return &outputHashes[i];
+	}
+	return 0;
+}
+
+void beginOutput()
+{
+	outputHashCount = outputFiles = outputKept = 0;
+	outputKeptBytes = 0;
+	if(!incremental) return;
+	char fname[600];
+	snprintf(fname, sizeof(fname), "%s/csworldgen.hashes", outputDir);
+	FILE* in = fopen(fname, "r");
+	if(!in) return;
+	OutputHash e;
+	while(outputHashCount < OUTPUT_FILES && fscanf(in, "%31s %llx %ld %ld", e.name, &e.hash, &e.size, &e.mtime) == 4)
+	{
+		outputHashes[outputHashCount++] = e;
+	}
+	fclose(in);
+}
+
+// writes the manifest and returns the bytes not written
+long endOutput()
+{
+	if(!incremental) return 0;
+	char fname[600];
+	char part[608];
+	snprintf(fname, sizeof(fname), "%s/csworldgen.hashes", outputDir);
+	snprintf(part, sizeof(part), "%s.part", fname);
+	FILE* out = fopen(part, "w");
+	checkError(out, part);
+	for(int i = 0; i < outputHashCount; ++i)
+	{
+		const OutputHash* e = &outputHashes[i];
+		fprintf(out, "%s %016llx %ld %ld\n", e->name, e->hash, e->size, e->mtime);
+	}
+	fclose(out);
+	#ifdef _WIN32
+	remove(fname);
+	#endif
+	if(rename(part, fname))
+	{
+		printf("Could not write %s, aborting\n", fname);
+		exit(EXIT_FAILURE);
+	}
+	return outputKeptBytes;
+}
+
+// writes the file name of outputDir, with -inc only if its content changed
+void writeOutput(const char* name, const void* data, size_t size, const char* mode)
+{
+	char fname[600];
+	snprintf(fname, sizeof(fname), "%s/%s", outputDir, name);
+	outputFiles++;
+	unsigned long long hash = 0;
+	OutputHash* e = 0;
+	if(incremental)
+	{
+		hash = contentHash(data, size);
+		e = findOutputHash(name);
+		struct stat info;
+		int exists = !stat(fname, &info) && (size_t)info.st_size == size;
+		int same = 0;
+		if(exists && e) same = e->hash == hash && e->size == (long)size && e->mtime == (long)info.st_mtime;
+		else if(exists)
+		{
+			size_t n;
+			unsigned char* old = readWholeFile(fname, &n);
+			same = old && n == size && (!size || !memcmp(old, data, size));
+			free(old);
+		}
+		if(same)
+		{
+			outputKept++;
+			outputKeptBytes += size;
+			if(!e && outputHashCount < OUTPUT_FILES) e = &outputHashes[outputHashCount++];
+			if(e)
+			{
+				snprintf(e->name, sizeof(e->name), "%s", name);
+				e->hash = hash;
+				e->size = size;
+				e->mtime = info.st_mtime;
+			}
+			return;
+		}
+	}
+	FILE* out = fopen(fname, mode);
+	checkError(out, fname);
+	fwrite(data, 1, size, out);
+	fclose(out);
+	if(!incremental) return;
+	if(!e && outputHashCount < OUTPUT_FILES) e = &outputHashes[outputHashCount++];
+	if(e)
+	{
+		struct stat info;
+		snprintf(e->name, sizeof(e->name), "%s", name);
+		e->hash = hash;
+		e->size = size;
+		e->mtime = stat(fname, &info) ? 0 : (long)info.st_mtime;
+	}
+}
+
+// removes the file name of outputDir and its manifest entry
+void removeOutput(const char* name)
+{
+	char fname[600];
+	snprintf(fname, sizeof(fname), "%s/%s", outputDir, name);
+	if(fileExists(fname)) remove(fname);
+	OutputHash* e = findOutputHash(name);
+	if(e) *e = outputHashes[--outputHashCount];
+}
+
+// the region buffer is not taken from the scratch area, the batch scheduler
+// writes regions while the next stages run
+void writeRegionFiles()
+{
+	char fname[512];
+	unsigned char* region = (unsigned char*)malloc(PACK_REGION_SIZE);
+	for(int i = 0; i < 28; ++i)
+	{
+		if(i % 8 > 3 || !regionWanted(i)) continue;
+
+		sprintf(fname, "Monde_%d", i);
+
+		if(regionIsEmpty(i % 8, i / 8)){
+			removeOutput(fname);
+			continue;
+		}
+
+		buildRegion(i, region);
+		writeOutput(fname, region, PACK_REGION_SIZE, "wb");
+	}
+	free(region);
+}
+
+void writeTreeFile()
+{
+	writeOutput("Monde_Arbre", &trees[0], 4 * treeNumber, "wb");
+}
+
+void writeDoodadsFile()
+{
+	size_t length;
+	char* doodads = formatDoodads(&length);
+	writeOutput("Monde_Doodads", doodads, length, "wb");
+	free(doodads);
+}
+
+// with -region the runs of the other regions are taken over from the existing file,
+// the selected ones come from this run (caves are only carved there)
+void writeVolumeFile()
+{
+	unsigned int* runs = volumeRuns;
+	int count = (volumeThreshold < 1.0) ? volumeRunCount : 0;
+	if(regionMask)
+	{
+		char fname[600];
+		snprintf(fname, sizeof(fname), "%s/Monde_Volume", outputDir);
+		size_t size = 0;
+		unsigned int* old = (unsigned int*)readWholeFile(fname, &size);
+		runs = (unsigned int*)malloc(size + 8 * count + 8);
+		int kept = 0;
+		for(size_t k = 0; k < size / 8; ++k)
+		{
+			int x = old[2 * k] % 1024;
+			int y = (old[2 * k] >> 10) % 1024;
+			if(regionWanted((y / 256) * 8 + x / 256)) continue;
+			runs[2 * kept] = old[2 * k];
+			runs[2 * kept + 1] = old[2 * k + 1];
+			kept++;
+		}
+		free(old);
+		memcpy(runs + 2 * kept, volumeRuns, 8 * count);
+		count += kept;
+	}
+	if(count || volumeThreshold < 1.0) writeOutput("Monde_Volume", runs, 8 * count, "wb");
+	else removeOutput("Monde_Volume");
+	if(runs != volumeRuns) free(runs);
+}
+
+void writeFiles()
+{
+	printf("writing files: ");
+	makeDirectory(outputDir);
+	beginOutput();
+	writeRegionFiles();
+	writeTreeFile();
+	writeDoodadsFile();
+	writeVolumeFile();
+	if(pgmOut) writePGMs();
+	if(infoOut) writeInfoFile();
+	endOutput();
+	if(incremental) printf(" %d of %d files unchanged, %ld bytes not written,", outputKept, outputFiles, outputKeptBytes);
+	printf(" done.\n");
+}
+
+// loading an existing world
+//
+// With -load the planes are read back from the Monde region files of a world
+// directory or a packed container, the dirt marks under the old trees are turned
+// back into grass. Planting and growing then give the same result as a full
+// generation with the same parameters.
+
+// inverse of buildRegion, a 0 region clears its cells
+void storeRegion(int i, const unsigned char* in)
+{
+	const unsigned char* c = in ? in + 2 : 0;
+	for(int y = (i / 8) * 256; y < ((i / 8) + 1) * 256; ++y)
+	{
+		for(int x = (i % 8) * 256; x < ((i % 8) + 1) * 256; ++x)
+		{
+			bottom[cell(x, y)] = c ? *c++ : 0;
+			top[cell(x, y)] = c ? *c++ : 0;
+			material[cell(x, y)] = c ? *c++ : 0;
+			fraction[cell(x, y)] = c ? *c++ : 0;
+		}
+	}
+}
+
+int isDirectory(const char* name)
+{
+	struct stat buffer;
+	return (stat(name, &buffer) == 0) && S_ISDIR(buffer.st_mode);
+}
+
+// takes the generation parameters and noise graphs from the info file of the
+// loaded world, info files from before -ti and -tf name the tree invert and falloff
+// with a second -hi and -hf
+void readInfoParameters(const char* info, size_t size)
+{
+	char* text = (char*)malloc(size + 1);
+	memcpy(text, info, size);
+	text[size] = 0;
+	char* line = strstr(text, "generation parameters:\n");
+	if(line)
+	{
+		line += strlen("generation parameters:\n");
+		char* end = strchr(line, '\n');
+		if(end) *end = 0;
+		char* args[128];
+		int count = 1;
+		int seenHeightInvert = 0;
+		int seenHeightFalloff = 0;
+		args[0] = (char*)"csworldgen.info";
+		for(char* token = strtok(line, " \t\r"); token && count < 128; token = strtok(0, " \t\r"))
+		{
+			if(!strcmp(token, "-hi") && seenHeightInvert++) token = (char*)"-ti";
+			if(!strcmp(token, "-hf") && seenHeightFalloff++) token = (char*)"-tf";
+			args[count++] = token;
+		}
+		parseParameters(count, args);
+		if(end) line = end + 1;
+		for(char* next = line; next && *next; line = next)
+		{
+			next = strchr(line, '\n');
+			if(next) *next++ = 0;
+			readGraphLine(line);
+		}
+	}
+	free(text);
+}
+
+// parameters of the loaded world, called before the command line is read again
+void loadParameters()
+{
+	char fname[600];
+	size_t size;
+	if(isDirectory(loadSource))
+	{
+		snprintf(fname, sizeof(fname), "%s/csworldgen.info", loadSource);
+		unsigned char* info = readWholeFile(fname, &size);
+		if(!info)
+		{
+			printf("warning: %s not found, using command line parameters\n", fname);
+			return;
+		}
+		readInfoParameters((const char*)info, size);
+		free(info);
+		return;
+	}
+	Pack pack;
+	if(openPack(loadSource, &pack))
+	{
+		printf("Could not open %s, aborting\n", loadSource);
+		exit(EXIT_FAILURE);
+	}
+	const unsigned char* info = packBlob(&pack, PACK_INFO, &size);
+	if(size) readInfoParameters((const char*)info, size);
+	else printf("warning: %s has no info, using command line parameters\n", loadSource);
+	closePack(&pack);
+}
+
+void loadWorld()
+{
+	printf("loading world: ");
+	char fname[600];
+	size_t size;
+	unsigned char* treeData;
+	if(isDirectory(loadSource))
+	{
+		for(int i = 0; i < 28; ++i)
+		{
+			if(i % 8 > 3) continue;
+			snprintf(fname, sizeof(fname), "%s/Monde_%d", loadSource, i);
+			unsigned char* region = readWholeFile(fname, &size);
+			if(region && size != PACK_REGION_SIZE)
+			{
+				printf("\n%s has %lu bytes instead of %d, aborting\n", fname, (unsigned long)size, PACK_REGION_SIZE);
+				exit(EXIT_FAILURE);
+			}
+			storeRegion(i, region);
+			free(region);
+		}
+		snprintf(fname, sizeof(fname), "%s/Monde_Arbre", loadSource);
+		treeData = readWholeFile(fname, &size);
+		if(!treeData) size = 0;
+	}
+	else
+	{
+		Pack pack;
+		if(openPack(loadSource, &pack))
+		{
+			printf("\nCould not open %s, aborting\n", loadSource);
+			exit(EXIT_FAILURE);
+		}
+		unsigned char* region = (unsigned char*)scratchAlloc(PACK_REGION_SIZE);
+		for(int k = 0; k < PACK_REGIONS; ++k)
+		{
+			int i = packRegionNumber(k);
+			if(packRegionEncoding(&pack, k) == PACK_EMPTY)
+			{
+				storeRegion(i, 0);
+				continue;
+			}
+			if(!packRegion(&pack, k, region))
+			{
+				printf("\n%s is damaged, aborting\n", loadSource);
+				exit(EXIT_FAILURE);
+			}
+			storeRegion(i, region);
+		}
+		scratchRelease(region, PACK_REGION_SIZE);
+		const unsigned char* blob = packBlob(&pack, PACK_TREES, &size);
+		treeData = (unsigned char*)malloc(size + 1);
+		memcpy(treeData, blob, size);
+		closePack(&pack);
+	}
+
+	// trees stand on grass that plantTrees() turned into dirt
+	for(size_t k = 0; k + 4 <= size; k += 4)
+	{
+		unsigned int tree;
+		memcpy(&tree, treeData + k, 4);
+		int x = tree % 1024;
+		int y = (tree >> 10) % 1024;
+		if(material[cell(x, y)] == DIRT) material[cell(x, y)] = GRASS;
+	}
+	free(treeData);
+
+	buildOccupancy();
+	prepareFalloff();
+	printf(" done.\n");
+}
+
+// performance counters
+//
+// -perf counts cycles, instructions, cache misses and branch misses of each
+// stage with perf_event_open (user space only, threads started by a stage are
+// included). Where the counters can not be opened only the times are reported.
+// The -layoutbench kernels have slots of their own, per layout and map size a
+// bottom pass and a disk scan slot.
+
+#define PERF_LOAD STAGE_COUNT
+#define PERF_WRITE (STAGE_COUNT + 1)
+#define PERF_LAYOUT (STAGE_COUNT + 2)
+#define PERF_SLOTS (PERF_LAYOUT + 12)
+#define PERF_EVENTS 4
+
+const char* perfSlotName[PERF_SLOTS] =
+{
+	"island", "top", "erosion", "bottom", "caves", "trees", "crystals", "load", "write",
+	"rows 1024 pass", "rows 1024 scan", "tiles 1024 pass", "tiles 1024 scan", "morton 1024 pass", "morton 1024 scan",
+	"rows 4096 pass", "rows 4096 scan", "tiles 4096 pass", "tiles 4096 scan", "morton 4096 pass", "morton 4096 scan"
+};
+const char* perfEventName[PERF_EVENTS] = {"cycles", "instructions", "cache misses", "branch misses"};
+
+struct PerfSlot
+{
+	int       runs;
+	double    ms;
+	long long count[PERF_EVENTS];
+	double    cells;  // cells visited for the per cell columns, 0 for the land cells of the world
+};
+
+int      perfFd[PERF_EVENTS] = {-1, -1, -1, -1};
+PerfSlot perfSlots[PERF_SLOTS];
+long long perfStart[PERF_EVENTS];
+std::chrono::steady_clock::time_point perfStartTime;
+
+void perfOpen()
+{
+	#ifdef __linux__
+	const unsigned long long config[PERF_EVENTS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+	int opened = 0;
+	for(int e = 0; e < PERF_EVENTS; ++e)
+	{
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config[e];
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.inherit = 1;
+		perfFd[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if(perfFd[e] >= 0) opened++;
+		else printf("performance counter %s unavailable: %s\n", perfEventName[e], strerror(errno));
+	}
+	if(!opened) printf("no performance counters, -perf reports times only\n");
+	#else
+	printf("performance counters need linux, -perf reports times only\n");
+	#endif
+}
+
+long long perfRead(int e)
+{
+	long long value = 0;
+	if(perfFd[e] < 0) return -1;
+	#ifdef __linux__
+	if(read(perfFd[e], &value, sizeof(value)) != sizeof(value)) return -1;
+	#endif
+	return value;
+}
+
+void perfBegin()
+{
+	if(!perfOut) return;
+	for(int e = 0; e < PERF_EVENTS; ++e) perfStart[e] = perfRead(e);
+	perfStartTime = std::chrono::steady_clock::now();
+}
+
+void perfEnd(int slot)
+{
+	if(!perfOut) return;
+	PerfSlot* p = &perfSlots[slot];
+	p->ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - perfStartTime).count();
+	for(int e = 0; e < PERF_EVENTS; ++e)
+	{
+		long long value = perfRead(e);
+		if(value < 0 || perfStart[e] < 0 || p->count[e] < 0) p->count[e] = -1;
+		else p->count[e] += value - perfStart[e];
+	}
+	p->runs++;
+}
+
+// prints a count, - where the counter is missing
+void printCount(long long count, double scale)
+{
+	if(count < 0) printf(" %12s", "-");
+	else printf(" %12.*lf", (scale == 1.0) ? 0 : 3, count / scale);
+}
+
+void printPerfReport()
+{
+	int land = 0;
+	if(material)
+	{
+		for(int y = 0; y < 1024; ++y)
+		{
+			for(int x = 0; x < 1024; ++x) land += (material[cell(x, y)] != 0);
+		}
+		printf("\nstage performance (per cell = per land cell, %d land cells)\n", land);
+	}
+	else printf("\nkernel performance (per cell = per cell visited)\n");
+	int width = 10;
+	for(int slot = 0; slot < PERF_SLOTS; ++slot)
+	{
+		if(perfSlots[slot].runs) width = MAX(width, (int)strlen(perfSlotName[slot]));
+	}
+	printf("%-*s %9s %12s %12s %6s %12s %12s %12s %12s\n", width, material ? "stage" : "kernel", "ms", "cycles", "instructions", "IPC",
+	       "cache miss", "per cell", "branch miss", "per cell");
+	for(int slot = 0; slot < PERF_SLOTS; ++slot)
+	{
+		const PerfSlot* p = &perfSlots[slot];
+		if(!p->runs) continue;
+		double cells = p->cells ? p->cells : (land ? land : 1);
+		printf("%-*s %9.2lf", width, perfSlotName[slot], p->ms);
+		printCount(p->count[0], 1.0);
+		printCount(p->count[1], 1.0);
+		if(p->count[0] > 0 && p->count[1] >= 0) printf(" %6.2lf", (double)p->count[1] / p->count[0]);
+		else printf(" %6s", "-");
+		printCount(p->count[2], 1.0);
+		printCount(p->count[2], cells);
+		printCount(p->count[3], 1.0);
+		printCount(p->count[3], cells);
+		printf("\n");
+	}
+}
+
+void runStages(int first, int last)
+{
+	prepareFalloff();
+	for(int stage = first; stage <= last; ++stage)
+	{
+		deadlineStage(stage);
+		perfBegin();
+		switch(stage)
+		{
+			case STAGE_ISLAND:
+				if(tiled) generateTiled();
+				else generateIsland();
+				break;
+			case STAGE_TOP:
+				// the tiled path computes island, top layer and rounding in one pass
+				if(tiled) break;
+				generateTop();
+				roundEdges();
+				break;
+			case STAGE_EROSION: erodeThermal(); break;
+			case STAGE_BOTTOM: generateBottom(); break;
+			case STAGE_VOLUME: carveVolume(); break;
+			case STAGE_TREES: plantTrees(); break;
+			case STAGE_CRYSTALS: growCrystals(); break;
+		}
+		perfEnd(stage);
+	}
+}
+
+// memory for results that tasks hand back to the main process
+void* sharedAlloc(size_t bytes)
+{
+	#ifdef __linux__
+	void* p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(p == MAP_FAILED) p = 0;
+	#else
+	void* p = malloc(bytes);
+	#endif
+	if(!p)
+	{
+		printf("Could not allocate %lu bytes, aborting\n", (unsigned long)bytes);
+		exit(EXIT_FAILURE);
+	}
+	memset(p, 0, bytes);
+	return p;
+}
+
+void sharedFree(void* p, size_t bytes)
+{
+	#ifdef __linux__
+	munmap(p, bytes);
+	#else
+	(void)bytes;
+	free(p);
+	#endif
+}
+
+// runs task(0) .. task(count - 1); on linux in -j forked worker processes that
+// take the next task from a shared counter, so the worlds a worker pools are
+// recycled over its tasks; a worker starts from a copy on write view of the
+// current world. Elsewhere one after the other in this process. quiet drops the
+// output of the tasks.
+void runTasks(int count, void (*task)(int k), int quiet)
+{
+	#ifdef __linux__
+	int* next = (int*)sharedAlloc(sizeof(int));
+	int workers = MIN(threads, count);
+	int running = 0;
+	for(int n = 0; n < workers; ++n)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if(pid == 0)
+		{
+			if(quiet && !freopen("/dev/null", "w", stdout)) _exit(EXIT_FAILURE);
+			for(int k = __sync_fetch_and_add(next, 1); k < count; k = __sync_fetch_and_add(next, 1))
+			{
+				task(k);
+				fflush(stdout);
+			}
+			_exit(EXIT_SUCCESS);
+		}
+		if(pid < 0)
+		{
+			printf("Could not start worker process %d\n", n);
+			continue;
+		}
+		running++;
+	}
+	while(running--) wait(0);
+	sharedFree(next, sizeof(int));
+	#else
+	(void)quiet;
+	for(int k = 0; k < count; ++k) task(k);
+	#endif
+}
+
+// parameter sweep
+//
+// -sweep name=first:last:step runs the stages that do not depend on the
+// parameter once, then every value continues from a copy of that world. On
+// linux the values run in -j worker processes (the shared world is read copy on
+// write), elsewhere one after the other.
+
+struct SweepParameter
+{
+	const char* name;
+	int*        intValue;
+	double*     doubleValue;
+	int         stage;
+};
+
+const SweepParameter sweepParameters[] =
+{
+	{"i", &islandSeed, 0, STAGE_ISLAND}, {"is", 0, &islandScale, STAGE_ISLAND},
+	{"io", &islandOctaves, 0, STAGE_ISLAND}, {"ios", 0, &islandOctaveScale, STAGE_ISLAND},
+	{"iop", 0, &islandOctavePersistence, STAGE_ISLAND}, {"ie", 0, &islandEdge, STAGE_ISLAND},
+	{"iz", 0, &islandSize, STAGE_ISLAND}, {"id", 0, &islandDensity, STAGE_ISLAND},
+	{"h", &heightSeed, 0, STAGE_TOP}, {"hs", 0, &heightScale, STAGE_TOP},
+	{"ho", &heightOctaves, 0, STAGE_TOP}, {"hos", 0, &heightOctaveScale, STAGE_TOP},
+	{"hop", 0, &heightOctavePersistence, STAGE_TOP}, {"hb", 0, &heightBase, STAGE_TOP},
+	{"ht", 0, &heightTop, STAGE_TOP}, {"he", 0, &heightExponent, STAGE_TOP},
+	{"hi", &heightValueInvert, 0, STAGE_TOP}, {"hf", &heightFalloff, 0, STAGE_TOP},
+	{"bm", &bottomMinThick, 0, STAGE_TOP},
+	{"e", &erosionIterations, 0, STAGE_EROSION}, {"et", 0, &erosionTalus, STAGE_EROSION},
+	{"eb", &erosionBudget, 0, STAGE_EROSION},
+	{"b", &bottomSeed, 0, STAGE_BOTTOM}, {"ba", 0, &bottomAdd, STAGE_BOTTOM},
+	{"v", &volumeSeed, 0, STAGE_VOLUME}, {"vs", 0, &volumeScale, STAGE_VOLUME},
+	{"vo", &volumeOctaves, 0, STAGE_VOLUME}, {"vos", 0, &volumeOctaveScale, STAGE_VOLUME},
+	{"vop", 0, &volumeOctavePersistence, STAGE_VOLUME}, {"vt", 0, &volumeThreshold, STAGE_VOLUME},
+	{"vm", &volumeMargin, 0, STAGE_VOLUME},
+	{"t", &treeSeed, 0, STAGE_TREES}, {"ts", 0, &treeScale, STAGE_TREES},
+	{"to", &treeOctaves, 0, STAGE_TREES}, {"tos", 0, &treeOctaveScale, STAGE_TREES},
+	{"top", 0, &treeOctavePersistence, STAGE_TREES}, {"tp", &treeSeedPos, 0, STAGE_TREES},
+	{"tn", &treeNumber, 0, STAGE_TREES}, {"td", 0, &treeDensity, STAGE_TREES},
+	{"ti", &treeValueInvert, 0, STAGE_TREES}, {"tf", &treeFalloff, 0, STAGE_TREES},
+	{"c", &crystalSeed, 0, STAGE_CRYSTALS}, {"cr", &crystalGrassRadius, 0, STAGE_CRYSTALS},
+	{"cn", &crystalNumber, 0, STAGE_CRYSTALS}, {"cd", &crystalDistance, 0, STAGE_CRYSTALS},
+	{"cs", 0, &crystalMaxSlope, STAGE_CRYSTALS}, {"csd", 0, &crystalStartPointDistance, STAGE_CRYSTALS}
+};
+
+struct SweepResult
+{
+	int    status;  // 0 not run, 1 done, 2 failed
+	int    trees;
+	int    crystals;
+	int    land;
+	int    highest;
+	double ms;
+};
+
+const SweepParameter* sweepParameter;
+double sweepFirst;
+double sweepStep;
+int    sweepCount;
+
+double sharedSweepMs;
+
+void parseSweep()
+{
+	char name[16];
+	double last;
+	int n = 0;
+	if(sscanf(sweepSpec, "%15[a-z]=%lf:%lf:%lf%n", name, &sweepFirst, &last, &sweepStep, &n) != 4 || sweepSpec[n] || sweepStep <= 0.0 || last < sweepFirst)
+	{
+		printf("error in -sweep %s: expected name=first:last:step with first <= last and step > 0\n", sweepSpec);
+		exit(EXIT_FAILURE);
+	}
+	sweepParameter = 0;
+	for(unsigned int i = 0; i < sizeof(sweepParameters) / sizeof(sweepParameters[0]); ++i)
+	{
+		if(!strcmp(name, sweepParameters[i].name)) sweepParameter = &sweepParameters[i];
+	}
+	if(!sweepParameter)
+	{
+		printf("error in -sweep %s: %s can not be swept\n", sweepSpec, name);
+		exit(EXIT_FAILURE);
+	}
+	sweepCount = (int)((last - sweepFirst) / sweepStep + 1e-9) + 1;
+}
+
+double sweepValue(int k)
+{
+	double value = sweepFirst + k * sweepStep;
+	if(sweepParameter->intValue) value = floor(value + 0.5);
+	return value;
+}
+
+unsigned int sweepDegraded;  // shared stages that stopped early
+
+// the remaining stages and the writer for value k, the world holds the shared stages;
+// every value gets the whole -deadline budget for them, the shared stages are not
+// charged to it
+void runSweepVariant(int k, const char* baseDir, SweepResult* result)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	deadlineStart();
+	degradedStages = sweepDegraded;
+	double value = sweepValue(k);
+	if(sweepParameter->intValue) *sweepParameter->intValue = value;
+	else *sweepParameter->doubleValue = value;
+	snprintf(outputDir, sizeof(outputDir), "%s/%s_%g", baseDir, sweepParameter->name, value);
+
+	int first = sweepParameter->stage;
+	if(tiled && first == STAGE_TOP) first = STAGE_ISLAND;
+	runStages(first, STAGE_CRYSTALS);
+	if(packOut) writePackFile();
+	else writeFiles();
+
+	result->trees = treeNumber;
+	result->crystals = crystalNumber;
+	result->land = 0;
+	result->highest = 0;
+	for(int y = 0; y < 1024; ++y)
+	{
+		for(int x = 0; x < 1024; ++x)
+		{
+			if(material[cell(x, y)] == 0) continue;
+			result->land++;
+			result->highest = MAX(result->highest, top[cell(x, y)]);
+		}
+	}
+	result->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	result->status = 1;
+}
+
+char         sweepDir[512];
+SweepResult* sweepResults;
+World*       sweepBase;
+World*       sweepCopy;  // of the process running the values
+int          sweepTrees;
+int          sweepCrystals;
+
+// every value starts from a copy of the shared stages, a worker process runs
+// several values in its own copy
+void sweepTask(int k)
+{
+	if(!sweepCopy) sweepCopy = acquireWorld();
+	memcpy(sweepCopy->arena, sweepBase->arena, sweepBase->scratchStart);
+	sweepCopy->falloffSize = sweepBase->falloffSize;
+	sweepCopy->falloffEdge = sweepBase->falloffEdge;
+	bindWorld(sweepCopy);
+	treeNumber = sweepTrees;
+	crystalNumber = sweepCrystals;
+	runSweepVariant(k, sweepDir, &sweepResults[k]);
+}
+
+void writeSweepSummary(const char* baseDir, const SweepResult* results, double sharedMs)
+{
+	char fname[512];
+	char line[1024];
+	snprintf(fname, sizeof(fname), "%s/sweep.txt", baseDir);
+	FILE* out = fopen(fname, "w");
+	checkError(out, fname);
+	printf("\n");
+	snprintf(line, sizeof(line), "sweep %s, shared stages %.1lf ms\n", sweepSpec, sharedMs);
+	fputs(line, out);
+	printf("%s", line);
+	snprintf(line, sizeof(line), "%-24s %10s %6s %8s %8s %8s %10s\n", "directory", "value", "trees", "crystals", "land", "highest", "ms");
+	fputs(line, out);
+	printf("%s", line);
+	for(int k = 0; k < sweepCount; ++k)
+	{
+		const SweepResult* r = &results[k];
+		char dir[64];
+		snprintf(dir, sizeof(dir), "%s_%g", sweepParameter->name, sweepValue(k));
+		if(r->status == 1) snprintf(line, sizeof(line), "%-24s %10g %6d %8d %8d %8d %10.1lf\n", dir, sweepValue(k), r->trees, r->crystals, r->land, r->highest, r->ms);
+		else snprintf(line, sizeof(line), "%-24s %10g failed\n", dir, sweepValue(k));
+		fputs(line, out);
+		printf("%s", line);
+	}
+	fclose(out);
+}
+
+// with -lc the octave layers the values share are filled before the values run,
+// so every one of them (a forked process on linux) only adds them up
+void fillSweepLayers()
+{
+	const char* name = sweepParameter->name;
+	int islandKey = !strcmp(name, "i") || !strcmp(name, "is") || !strcmp(name, "io") || !strcmp(name, "ios");
+	int heightKey = !strcmp(name, "h") || !strcmp(name, "hs") || !strcmp(name, "ho") || !strcmp(name, "hos");
+	if(sweepParameter->stage == STAGE_ISLAND && !islandKey)
+	{
+		fillLayers(LAYER_ISLAND, fullRect);
+		fillLayers(LAYER_HEIGHT, fullRect);
+	}
+	else if(sweepParameter->stage == STAGE_TOP && !heightKey) forEachLandBox(fillHeightLayers);
+	saveLayers();
+}
+
+// the shared stages run in the bound world, it is the base every value is copied from
+void runSweep()
+{
+	int last = sweepParameter->stage - 1;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if(strcmp(loadSource, ""))
+	{
+		if(last < STAGE_BOTTOM)
+		{
+			printf("-sweep %s changes the terrain of the loaded world, aborting\n", sweepParameter->name);
+			exit(EXIT_FAILURE);
+		}
+		loadWorld();
+		runStages(STAGE_VOLUME, last);
+	}
+	else
+	{
+		if(tiled && last == STAGE_ISLAND) last = -1;
+		runStages(STAGE_ISLAND, last);
+	}
+	sharedSweepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	sweepDegraded = degradedStages;
+
+	if(layerCache) fillSweepLayers();
+
+	strcpy(sweepDir, outputDir);
+	makeDirectory(sweepDir);
+
+	sweepResults = (SweepResult*)sharedAlloc(sweepCount * sizeof(SweepResult));
+	sweepBase = world;
+	sweepCopy = 0;
+	sweepTrees = treeNumber;
+	sweepCrystals = crystalNumber;
+	runTasks(sweepCount, sweepTask, 0);
+	bindWorld(sweepBase);
+	if(sweepCopy) releaseWorld(sweepCopy);
+
+	writeSweepSummary(sweepDir, sweepResults, sharedSweepMs);
+	sharedFree(sweepResults, sweepCount * sizeof(SweepResult));
+}
+
+// seed sets
+//
+// Batches and searches generate world k with every seed of the command line
+// advanced by k, so each world can be generated again on its own.
+
+struct SeedSet
+{
+	int island, height, bottom, tree, treePos, crystal, volume, trees, crystals;
+};
+
+SeedSet seedBase;
+
+void saveSeeds()
+{
+	SeedSet s = {islandSeed, heightSeed, bottomSeed, treeSeed, treeSeedPos, crystalSeed, volumeSeed, treeNumber, crystalNumber};
+	seedBase = s;
+}
+
+void useSeeds(int k)
+{
+	islandSeed = (seedBase.island + k) % 0x8000;
+	heightSeed = (seedBase.height + k) % 0x8000;
+	bottomSeed = (seedBase.bottom + k) % 0x8000;
+	treeSeed = (seedBase.tree + k) % 0x8000;
+	treeSeedPos = (seedBase.treePos + k) % 0x8000;
+	crystalSeed = (seedBase.crystal + k) % 0x8000;
+	volumeSeed = (seedBase.volume + k) % 0x8000;
+	treeNumber = seedBase.trees;
+	crystalNumber = seedBase.crystals;
+}
+
+// a task starts from a world of the pool of its process, in a forked worker the
+// first one is new and the next ones are recycled
+void freshWorld()
+{
+	releaseWorld(world);
+	bindWorld(acquireWorld());
+}
+
+// world task scheduler
+//
+// The stages of a world and the files written from them form a task graph.
+// Compute tasks run on the calling thread in table order, which is a
+// topological order that plants the trees before the caves and crystals so
+// the regions can be written early; they share rand() and the noise
+// permutation and never run at the same time. File tasks run on an I/O thread
+// as soon as the tasks they depend on are done, overlapping the remaining stages.
+// There is no work stealing pool: the stages use the bound global planes, so the
+// compute of one world overlaps the I/O of another only across the worker
+// processes of runTasks, never inside one process.
+
+#define TASK_ISLAND 0
+#define TASK_TOP 1
+#define TASK_EROSION 2
+#define TASK_BOTTOM 3
+#define TASK_TREES 4
+#define TASK_REGIONS 5
+#define TASK_TREE_FILE 6
+#define TASK_CAVES 7
+#define TASK_CAVE_FILE 8
+#define TASK_CRYSTALS 9
+#define TASK_DOODADS 10
+#define TASK_INFO 11
+#define TASK_PGM 12
+#define TASK_COUNT 13
+
+#define AFTER(t) (1u << (t))
+
+void islandTask() { runStages(STAGE_ISLAND, STAGE_ISLAND); }
+void topTask() { runStages(STAGE_TOP, STAGE_TOP); }
+void erosionTask() { runStages(STAGE_EROSION, STAGE_EROSION); }
+void bottomTask() { runStages(STAGE_BOTTOM, STAGE_BOTTOM); }
+void treesTask() { runStages(STAGE_TREES, STAGE_TREES); }
+void cavesTask() { runStages(STAGE_VOLUME, STAGE_VOLUME); }
+void crystalsTask() { runStages(STAGE_CRYSTALS, STAGE_CRYSTALS); }
+void infoTask() { if(infoOut) writeInfoFile(); }
+void pgmTask() { if(pgmOut) writePGMs(); }
+
+struct WorldTask
+{
+	const char*  name;
+	void         (*run)();
+	unsigned int after;
+	int          io;
+};
+
+const WorldTask worldTasks[TASK_COUNT] =
+{
+	{"island", islandTask, 0, 0},
+	{"top", topTask, AFTER(TASK_ISLAND), 0},
+	{"erosion", erosionTask, AFTER(TASK_TOP), 0},
+	{"bottom", bottomTask, AFTER(TASK_EROSION), 0},
+	{"trees", treesTask, AFTER(TASK_EROSION), 0},
+	{"regions", writeRegionFiles, AFTER(TASK_BOTTOM) | AFTER(TASK_TREES), 1},
+	{"tree file", writeTreeFile, AFTER(TASK_TREES), 1},
+	{"caves", cavesTask, AFTER(TASK_BOTTOM), 0},
+	{"cave file", writeVolumeFile, AFTER(TASK_CAVES), 1},
+	{"crystals", crystalsTask, AFTER(TASK_TREES), 0},
+	{"doodads", writeDoodadsFile, AFTER(TASK_CRYSTALS), 1},
+	{"info", infoTask, AFTER(TASK_TREES) | AFTER(TASK_CRYSTALS), 1},
+	{"pgm", pgmTask, AFTER(TASK_BOTTOM) | AFTER(TASK_TREES), 1}
+};
+
+std::mutex              taskLock;
+std::condition_variable taskChanged;
+unsigned int            tasksDone;
+
+void runIoTasks()
+{
+	unsigned int started = 0;
+	std::unique_lock<std::mutex> guard(taskLock);
+	for(;;)
+	{
+		int next = -1;
+		int pending = 0;
+		for(int t = 0; t < TASK_COUNT; ++t)
+		{
+			if(!worldTasks[t].io || (started & AFTER(t))) continue;
+			pending++;
+			if((worldTasks[t].after & tasksDone) == worldTasks[t].after)
+			{
+				next = t;
+				break;
+			}
+		}
+		if(!pending) return;
+		if(next < 0)
+		{
+			taskChanged.wait(guard);
+			continue;
+		}
+		started |= AFTER(next);
+		guard.unlock();
+		worldTasks[next].run();
+		guard.lock();
+	}
+}
+
+// generates the current world and writes it to outputDir
+void runWorldTasks()
+{
+	makeDirectory(outputDir);
+	beginOutput();
+	tasksDone = 0;
+	std::thread io(runIoTasks);
+	for(int t = 0; t < TASK_COUNT; ++t)
+	{
+		if(worldTasks[t].io) continue;
+		worldTasks[t].run();
+		{
+			std::lock_guard<std::mutex> guard(taskLock);
+			tasksDone |= AFTER(t);
+		}
+		taskChanged.notify_all();
+	}
+	io.join();
+	endOutput();
+}
+
+// batch
+//
+// -batch n generates n worlds (see seed sets) into <-o>/world_<k>, up to -j
+// processes at a time (see runTasks), each overlapping its computation with
+// writing its files.
+
+struct BatchResult
+{
+	int    status;
+	int    trees;
+	int    crystals;
+	double ms;
+	long   kept;   // bytes of unchanged files not written (-inc)
+};
+
+BatchResult* batchResults;
+char         batchDir[480];
+
+void batchTask(int k)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	useSeeds(k);
+	freshWorld();
+	deadlineStart();
+	snprintf(outputDir, sizeof(outputDir), "%s/world_%d", batchDir, k);
+	if(packOut)
+	{
+		runStages(STAGE_ISLAND, STAGE_CRYSTALS);
+		writePackFile();
+	}
+	else runWorldTasks();
+	BatchResult* r = &batchResults[k];
+	r->trees = treeNumber;
+	r->crystals = crystalNumber;
+	r->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	r->kept = outputKeptBytes;
+	r->status = 1;
+}
+
+void formatBatchRow(char* buf, size_t size, const SeedSet* base, int k, const BatchResult* r)
+{
+	char dir[32];
+	snprintf(dir, sizeof(dir), "world_%d", k);
+	if(r->status != 1)
+	{
+		snprintf(buf, size, "%-16s failed\n", dir);
+		return;
+	}
+	snprintf(buf, size, "%-16s %6d %6d %6d %6d %6d %6d %6d %6d %8d %10.1lf\n", dir,
+	         (base->island + k) % 0x8000, (base->height + k) % 0x8000, (base->bottom + k) % 0x8000,
+	         (base->tree + k) % 0x8000, (base->treePos + k) % 0x8000, (base->crystal + k) % 0x8000, (base->volume + k) % 0x8000,
+	         r->trees, r->crystals, r->ms);
+}
+
+const char batchHeader[] = "%-16s %6s %6s %6s %6s %6s %6s %6s %6s %8s %10s\n";
+
+void runBatch()
+{
+	saveSeeds();
+	const SeedSet base = seedBase;
+	snprintf(batchDir, sizeof(batchDir), "%.479s", outputDir);
+	makeDirectory(batchDir);
+
+	printf("generating %d worlds: ", batchCount);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	batchResults = (BatchResult*)sharedAlloc(batchCount * sizeof(BatchResult));
+	runTasks(batchCount, batchTask, 1);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf(" done.\n");
+
+	char fname[512];
+	snprintf(fname, sizeof(fname), "%s/batch.txt", batchDir);
+	FILE* out = fopen(fname, "w");
+	checkError(out, fname);
+	int failed = 0;
+	for(int k = 0; k < batchCount; ++k) failed += (batchResults[k].status != 1);
+	fprintf(out, "generated %d worlds in %.1lf ms (%.2lf per second), %d failed\n", batchCount - failed, ms, (batchCount - failed) * 1000.0 / ms, failed);
+	printf("generated %d worlds in %.1lf ms (%.2lf per second), %d failed\n", batchCount - failed, ms, (batchCount - failed) * 1000.0 / ms, failed);
+	if(incremental)
+	{
+		long kept = 0;
+		for(int k = 0; k < batchCount; ++k) kept += batchResults[k].kept;
+		fprintf(out, "%ld bytes of unchanged files not written\n", kept);
+		printf("%ld bytes of unchanged files not written\n", kept);
+	}
+	fprintf(out, "\n");
+	fprintf(out, batchHeader, "directory", "-i", "-h", "-b", "-t", "-tp", "-c", "-v", "trees", "crystals", "ms");
+	for(int k = 0; k < batchCount; ++k)
+	{
+		char line[256];
+		formatBatchRow(line, sizeof(line), &base, k, &batchResults[k]);
+		fputs(line, out);
+	}
+	fclose(out);
+	sharedFree(batchResults, batchCount * sizeof(BatchResult));
+}
+
+// work queue
+//
+// With -queue c the worlds of -batch are split into chunks of c worlds that any
+// number of workers (csworldgen processes started with the same -o, on this or
+// other hosts sharing the directory) work through without a coordinator. The
+// only atomic step used is creating a new file (link() of a private file, a
+// rename() that does not replace on windows), which works on network file
+// systems as well. A chunk n is claimed by creating its lease queue/chunk_<n>.<g>;
+// the worker rewrites it after every world, and one that was not rewritten for -ql
+// seconds is taken over by creating lease g + 1. The old owner stops once it sees
+// the newer lease, and a chunk is done when its manifest queue/chunk_<n>.txt is
+// there. Worlds are deterministic, so a world generated twice is written identically.
+
+char   queueDir[480];
+char   workerId[128];
+int    queueChunk;   // chunk of this worker and its lease generation
+int    queueLease;
+int    queueFirst;   // first world of the chunk
+SeedSet queueBase;
+
+void makeWorkerId()
+{
+	char host[64] = "";
+	#ifdef _WIN32
+	const char* name = getenv("COMPUTERNAME");
+	if(name) snprintf(host, sizeof(host), "%s", name);
+	snprintf(workerId, sizeof(workerId), "%s_%d", host, _getpid());
+	#else
+	gethostname(host, sizeof(host) - 1);
+	snprintf(workerId, sizeof(workerId), "%s_%d", host, (int)getpid());
+	#endif
+}
+
+// creates fname with the given text unless it exists, returns 1 if this call created it
+int createExclusive(const char* fname, const char* text)
+{
+	char part[700];
+	snprintf(part, sizeof(part), "%s.%s.part", fname, workerId);
+	FILE* out = fopen(part, "w");
+	checkError(out, part);
+	fputs(text, out);
+	fclose(out);
+	#ifdef _WIN32
+	int created = !rename(part, fname);
+	#else
+	int created = !link(part, fname);
+	#endif
+	remove(part);
+	return created;
+}
+
+// writes fname through a private file, readers never see it half written
+void replaceFile(const char* fname, const char* text)
+{
+	char part[700];
+	snprintf(part, sizeof(part), "%s.%s.part", fname, workerId);
+	FILE* out = fopen(part, "w");
+	checkError(out, part);
+	fputs(text, out);
+	fclose(out);
+	#ifdef _WIN32
+	remove(fname);
+	#endif
+	if(rename(part, fname))
+	{
+		printf("Could not write %s, aborting\n", fname);
+		exit(EXIT_FAILURE);
+	}
+}
+
+void leaseName(char* fname, size_t size, int n, int g)
+{
+	snprintf(fname, size, "%s/queue/chunk_%d.%d", queueDir, n, g);
+}
+
+void manifestName(char* fname, size_t size, int n)
+{
+	snprintf(fname, size, "%s/queue/chunk_%d.txt", queueDir, n);
+}
+
+int chunkCount()
+{
+	return (batchCount + queueSize - 1) / queueSize;
+}
+
+int chunkDone(int n)
+{
+	char fname[600];
+	manifestName(fname, sizeof(fname), n);
+	return fileExists(fname);
+}
+
+// the newest lease generation of a chunk and when it was renewed, -1 if it was never claimed
+int newestLease(int n, time_t* renewed)
+{
+	char fname[600];
+	for(int g = 0; ; ++g)
+	{
+		struct stat info;
+		leaseName(fname, sizeof(fname), n, g);
+		if(stat(fname, &info)) return g - 1;
+		*renewed = info.st_mtime;
+	}
+}
+
+// claims chunk n if it is free or abandoned, returns the lease generation or -1
+int claimChunk(int n)
+{
+	time_t renewed = 0;
+	int g = newestLease(n, &renewed);
+	if(g >= 0 && time(0) - renewed < queueTimeout) return -1;
+	char fname[600];
+	char text[192];
+	leaseName(fname, sizeof(fname), n, g + 1);
+	snprintf(text, sizeof(text), "%s %ld\n", workerId, (long)time(0));
+	return createExclusive(fname, text) ? g + 1 : -1;
+}
+
+// renews the lease of the chunk, 0 if another worker took the chunk over
+int renewLease()
+{
+	char fname[600];
+	struct stat info;
+	leaseName(fname, sizeof(fname), queueChunk, queueLease + 1);
+	if(!stat(fname, &info)) return 0;
+	leaseName(fname, sizeof(fname), queueChunk, queueLease);
 	FILE* out = fopen(fname, "w");
 	checkError(out, fname);
-	fprintf(out, "Generated with csworldgen %s (https://github.com/Draradech/csworldgen)\n", version);
-	fprintf(out, "\n");
-	fprintf(out, "generation parameters:\n");
-	fprintf(out, "-i %d -is %lf -io %d -ios %lf -iop %lf ", islandSeed, islandScale, islandOctaves, islandOctaveScale, islandOctavePersistence);
-	fprintf(out, "-ie %lf -iz %lf -id %lf ", islandEdge, islandSize, islandDensity);
-	fprintf(out, "-h %d -hs %lf -ho %d -hos %lf -hop %lf ", heightSeed, heightScale, heightOctaves, heightOctaveScale, heightOctavePersistence);
-	fprintf(out, "-hb %lf -ht %lf -he %lf -hi %d -hf %d ", heightBase, heightTop, heightExponent, heightValueInvert, heightFalloff);
-	fprintf(out, "-b %d -ba %lf -bm %d ", bottomSeed, bottomAdd, bottomMinThick);
-	fprintf(out, "-t %d -ts %lf -to %d -tos %lf -top %lf ", treeSeed, treeScale, treeOctaves, treeOctaveScale, treeOctavePersistence);
-	fprintf(out, "-tp %d -tn %d -td %lf -hi %d -hf %d ", treeSeedPos, treeNumber, treeDensity, treeValueInvert, treeFalloff);
-	fprintf(out, "-c %d -cr %d -cn %d -cd %d -cs %lf -csd %lf\n", crystalSeed, crystalGrassRadius, crystalNumber, crystalDistance, crystalMaxSlope, crystalStartPointDistance);
+	fprintf(out, "%s %ld\n", workerId, (long)time(0));
 	fclose(out);
+	return 1;
 }
 
-int fileExists(const char* name)
+// parameters of the queue: the first worker writes its own, every worker
+// (the first one too) then reads them back, so all of them use the same values
+void joinQueue()
 {
-	struct stat info;
-	return !stat(name, &info);
+	char fname[600];
+	char* job = (char*)malloc(16384);
+	snprintf(job, 16384, "work queue: -batch %d -queue %d\n\n", batchCount, queueSize);
+	formatInfo(job + strlen(job), 16384 - strlen(job));
+	snprintf(fname, sizeof(fname), "%s/queue/job.txt", queueDir);
+	createExclusive(fname, job);
+	free(job);
+
+	size_t size;
+	unsigned char* text = readWholeFile(fname, &size);
+	if(!text || sscanf((const char*)text, "work queue: -batch %d -queue %d", &batchCount, &queueSize) != 2 || batchCount < 1 || queueSize < 1)
+	{
+		printf("%s is damaged, aborting\n", fname);
+		exit(EXIT_FAILURE);
+	}
+	readInfoParameters((const char*)text, size);
+	free(text);
 }
 
-void writeFiles()
+void queueTask(int i)
 {
-	char fname[512];
-	FILE* out;
+	if(!renewLease()) return;
+	batchTask(queueFirst + i);
+	renewLease();
+}
 
-	printf("writing files: ");
+// generates chunk n under lease g, returns the number of worlds or 0 if the chunk was taken over
+int runChunk(int n, int g)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	queueChunk = n;
+	queueLease = g;
+	queueFirst = n * queueSize;
+	int count = MIN(queueSize, batchCount - queueFirst);
+	memset(batchResults, 0, batchCount * sizeof(BatchResult));
+	runTasks(count, queueTask, 1);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if(!renewLease()) return 0;
 
-	if(!fileExists(outputDir))
+	size_t size = 256 + (count + 2) * 256;
+	char* manifest = (char*)malloc(size);
+	int failed = 0;
+	for(int k = queueFirst; k < queueFirst + count; ++k) failed += (batchResults[k].status != 1);
+	snprintf(manifest, size, "chunk %d, worlds %d to %d, worker %s, lease %d, %.1lf ms, %d failed\n\n", n, queueFirst, queueFirst + count - 1, workerId, g, ms, failed);
+	appendf(manifest, size, batchHeader, "directory", "-i", "-h", "-b", "-t", "-tp", "-c", "-v", "trees", "crystals", "ms");
+	for(int k = queueFirst; k < queueFirst + count; ++k)
 	{
-		int status;
-		#ifdef _WIN32
-		status = mkdir(outputDir);
-		#else
-		status = mkdir(outputDir, 0777);
-		#endif
-		if(status)
+		char line[256];
+		formatBatchRow(line, sizeof(line), &queueBase, k, &batchResults[k]);
+		appendf(manifest, size, "%s", line);
+	}
+	char fname[600];
+	manifestName(fname, sizeof(fname), n);
+	replaceFile(fname, manifest);
+	free(manifest);
+	return count;
+}
+
+// queue.txt from the first lines of the manifests, written by every worker that finds all chunks done
+void writeQueueSummary()
+{
+	int chunks = chunkCount();
+	size_t size = 256 + chunks * 256;
+	char* summary = (char*)malloc(size);
+	summary[0] = 0;
+	appendf(summary, size, "%d worlds in %d chunks of %d\n\n", batchCount, chunks, queueSize);
+	for(int n = 0; n < chunks; ++n)
+	{
+		char fname[600];
+		char line[256] = "";
+		manifestName(fname, sizeof(fname), n);
+		FILE* in = fopen(fname, "r");
+		if(in)
 		{
-			printf("Could not create output directory %s, aborting\n", outputDir);
-			exit(EXIT_FAILURE);
+			if(!fgets(line, sizeof(line), in)) line[0] = 0;
+			fclose(in);
 		}
+		if(!strchr(line, '\n')) snprintf(line, sizeof(line), "chunk %d missing\n", n);
+		appendf(summary, size, "%s", line);
 	}
+	char fname[600];
+	snprintf(fname, sizeof(fname), "%s/queue.txt", queueDir);
+	replaceFile(fname, summary);
+	free(summary);
+}
 
-	for(int i = 0; i < 28; ++i)
+void runQueue()
+{
+	char dir[600];
+	snprintf(queueDir, sizeof(queueDir), "%.479s", outputDir);
+	makeDirectory(queueDir);
+	snprintf(dir, sizeof(dir), "%s/queue", queueDir);
+	makeDirectory(dir);
+	makeWorkerId();
+	joinQueue();
+	saveSeeds();
+	queueBase = seedBase;
+	snprintf(batchDir, sizeof(batchDir), "%s", queueDir);
+
+	printf("worker %s, %d worlds in chunks of %d: ", workerId, batchCount, queueSize);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	batchResults = (BatchResult*)sharedAlloc(batchCount * sizeof(BatchResult));
+	int chunks = 0;
+	int worlds = 0;
+	for(;;)
 	{
-		if(i % 8 > 3) continue;
+		// chunks that are taken are looked at again until they are done or abandoned
+		int open = 0;
+		int claimed = 0;
+		for(int n = 0; n < chunkCount() && !claimed; ++n)
+		{
+			if(chunkDone(n)) continue;
+			open++;
+			int g = claimChunk(n);
+			if(g < 0) continue;
+			claimed = 1;
+			int count = runChunk(n, g);
+			chunks += (count > 0);
+			worlds += count;
+			printf(".");
+			fflush(stdout);
+		}
+		if(!open) break;
+		if(!claimed) std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf(" done.\n");
+	printf("worker %s generated %d worlds in %d chunks in %.1lf ms\n", workerId, worlds, chunks, ms);
+	writeQueueSummary();
+	sharedFree(batchResults, batchCount * sizeof(BatchResult));
+}
+
+// seed search
+//
+// -search n generates candidates with every seed advanced by 0 .. n - 1 as tasks
+// (see runTasks). The land area and the distance of the land to the map border
+// are checked right after the island outline, so most rejected candidates never
+// run the expensive stages. Accepted candidates need all trees and crystals and a
+// valid start point; the -sk best are generated again and written.
+
+#define SEARCH_REJECTED_LAND 1
+#define SEARCH_REJECTED_BORDER 2
+#define SEARCH_REJECTED_TREES 3
+#define SEARCH_REJECTED_CRYSTALS 4
+#define SEARCH_REJECTED_START 5
+#define SEARCH_ACCEPTED 6
+
+const char* searchStatusName[] = {"failed", "land area", "border", "trees", "crystals", "start point", "accepted"};
+
+struct SearchResult
+{
+	int    status;
+	int    land;
+	int    trees;
+	int    crystals;
+	double ms;
+};
 
-		sprintf(fname, "%s/Monde_%d", outputDir, i);
+SearchResult* searchResults;
+char          searchDir[480];
+int*          searchRanking;
 
-		int isEmpty = 1;
-		for(int y = (i / 8) * 256; isEmpty && y < ((i / 8) + 1) * 256; ++y)
+void searchCandidate(int k)
+{
+	useSeeds(k);
+	freshWorld();
+}
+
+// island checks, the occupancy index gives the land bounding box
+int searchIsland(SearchResult* r)
+{
+	r->land = 0;
+	int x0 = 1024, y0 = 1024, x1 = 0, y1 = 0;
+	for(int ty = 0; ty < OCC_TILES; ++ty)
+	{
+		for(int tx = 0; tx < OCC_TILES; ++tx)
 		{
-			for(int x = (i % 8) * 256; isEmpty && x < ((i % 8) + 1) * 256; ++x)
+			const TileInfo* t = &occupancy[ty][tx];
+			if(t->flags == TILE_EMPTY) continue;
+			x0 = MIN(x0, t->x0);
+			y0 = MIN(y0, t->y0);
+			x1 = MAX(x1, t->x1);
+			y1 = MAX(y1, t->y1);
+			if(t->flags == TILE_LAND)
+			{
+				r->land += OCC_TILE * OCC_TILE;
+				continue;
+			}
+			for(int y = t->y0; y < t->y1; ++y)
 			{
-				if(material[y][x] != 0) isEmpty = 0;
+				for(int x = t->x0; x < t->x1; ++x) r->land += (material[cell(x, y)] != 0);
 			}
 		}
-		if(isEmpty){
-			if(fileExists(fname)) remove(fname);
-			continue;
+	}
+	double area = r->land / (1024.0 * 1024.0);
+	if(area < searchLandMin || area > searchLandMax) return SEARCH_REJECTED_LAND;
+	if(r->land && (x0 < searchMargin || y0 < searchMargin || x1 > 1024 - searchMargin || y1 > 1024 - searchMargin)) return SEARCH_REJECTED_BORDER;
+	return 0;
+}
+
+void searchTask(int k)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	SearchResult* r = &searchResults[k];
+	searchCandidate(k);
+	deadlineStart();
+	runStages(STAGE_ISLAND, STAGE_ISLAND);
+	r->status = searchIsland(r);
+	if(!r->status)
+	{
+		runStages(STAGE_TOP, STAGE_CRYSTALS);
+		r->trees = treeNumber;
+		r->crystals = crystalNumber;
+		if(treeNumber < seedBase.trees) r->status = SEARCH_REJECTED_TREES;
+		else if(crystalNumber < seedBase.crystals) r->status = SEARCH_REJECTED_CRYSTALS;
+		else if(!startPointValid) r->status = SEARCH_REJECTED_START;
+		else r->status = SEARCH_ACCEPTED;
+	}
+	r->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// distance of the land area to the middle of the accepted range, smaller is better
+double searchScore(const SearchResult* r)
+{
+	return fabs(r->land / (1024.0 * 1024.0) - (searchLandMin + searchLandMax) / 2);
+}
+
+int compareSearch(const void* a, const void* b)
+{
+	int ka = *(const int*)a;
+	int kb = *(const int*)b;
+	double sa = searchScore(&searchResults[ka]);
+	double sb = searchScore(&searchResults[kb]);
+	if(sa != sb) return (sa < sb) ? -1 : 1;
+	return ka - kb;
+}
+
+void writeSearchTask(int n)
+{
+	int k = searchRanking[n];
+	searchCandidate(k);
+	deadlineStart();
+	runStages(STAGE_ISLAND, STAGE_CRYSTALS);
+	snprintf(outputDir, sizeof(outputDir), "%s/candidate_%d", searchDir, k);
+	if(packOut) writePackFile();
+	else writeFiles();
+}
+
+void runSearch()
+{
+	saveSeeds();
+	const SeedSet base = seedBase;
+	snprintf(searchDir, sizeof(searchDir), "%.479s", outputDir);
+	makeDirectory(searchDir);
+
+	printf("searching %d candidates: ", searchCount);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	searchResults = (SearchResult*)sharedAlloc(searchCount * sizeof(SearchResult));
+	runTasks(searchCount, searchTask, 1);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	printf(" done.\n");
+
+	int counts[SEARCH_ACCEPTED + 1] = {0};
+	int accepted = 0;
+	searchRanking = new int[searchCount];
+	for(int k = 0; k < searchCount; ++k)
+	{
+		counts[searchResults[k].status]++;
+		if(searchResults[k].status == SEARCH_ACCEPTED) searchRanking[accepted++] = k;
+	}
+	qsort(searchRanking, accepted, sizeof(int), compareSearch);
+	int keep = MIN(accepted, searchKeep);
+
+	char fname[512];
+	char line[1024];
+	snprintf(fname, sizeof(fname), "%s/search.txt", searchDir);
+	FILE* out = fopen(fname, "w");
+	checkError(out, fname);
+	snprintf(line, sizeof(line), "searched %d candidates in %.1lf ms, %d accepted, writing %d\n", searchCount, ms, accepted, keep);
+	fputs(line, out);
+	printf("%s", line);
+	for(int s = 0; s <= SEARCH_ACCEPTED; ++s)
+	{
+		if(!counts[s]) continue;
+		snprintf(line, sizeof(line), "  %-12s %d\n", searchStatusName[s], counts[s]);
+		fputs(line, out);
+		printf("%s", line);
+	}
+	fprintf(out, "\n%-16s %6s %6s %6s %6s %6s %6s %6s %8s %6s %8s %-12s %10s\n", "directory", "-i", "-h", "-b", "-t", "-tp", "-c", "-v", "land", "trees", "crystals", "result", "ms");
+	for(int k = 0; k < searchCount; ++k)
+	{
+		const SearchResult* r = &searchResults[k];
+		char dir[32];
+		snprintf(dir, sizeof(dir), "candidate_%d", k);
+		fprintf(out, "%-16s %6d %6d %6d %6d %6d %6d %6d %8d %6d %8d %-12s %10.1lf\n", dir,
+		        (base.island + k) % 0x8000, (base.height + k) % 0x8000, (base.bottom + k) % 0x8000,
+		        (base.tree + k) % 0x8000, (base.treePos + k) % 0x8000, (base.crystal + k) % 0x8000, (base.volume + k) % 0x8000,
+		        r->land, r->trees, r->crystals, searchStatusName[r->status], r->ms);
+	}
+	fclose(out);
+
+	for(int n = 0; n < keep; ++n) printf("  candidate_%d land %.3lf\n", searchRanking[n], searchResults[searchRanking[n]].land / (1024.0 * 1024.0));
+	runTasks(keep, writeSearchTask, 1);
+	delete[] searchRanking;
+	sharedFree(searchResults, searchCount * sizeof(SearchResult));
+}
+
+// plane layout benchmark
+//
+// The kernels of the neighbor heavy stages on planes of n x n cells, n = 2^bits:
+// one smoothing pass of generateBottom (4 neighbors, rows visited in order as the
+// stage has to for rand(), then the copy back) and the disk scans of growCrystals
+// (radius 16) around spread out centers. Index math is the same as cell() uses.
+
+volatile long benchSink;  // keeps the results of the kernels alive
+
+template <int layout, int bits>
+static inline size_t benchCell(int x, int y)
+{
+	const int mask = (1 << bits) - 1;
+	if(layout == 1)
+	{
+		x &= mask;
+		y &= mask;
+		return ((size_t)(y >> 5) << (bits + 5)) + ((size_t)(x >> 5) << 10) + ((y & 31) << 5) + (x & 31);
+	}
+	if(layout == 2) return (size_t)mortonBits(x & mask) | ((size_t)mortonBits(y & mask) << 1);
+	return ((size_t)y << bits) + x;
+}
+
+// slot is the perf slot of the bottom pass, the disk scans use the next one
+template <int layout, int bits>
+void benchLayout(int slot, double* passMs, double* scanMs)
+{
+	const int n = 1 << bits;
+	const size_t cells = (size_t)n * n;
+	unsigned char* b = (unsigned char*)malloc(cells);
+	unsigned char* t = (unsigned char*)malloc(cells);
+	unsigned char* m = (unsigned char*)malloc(cells);
+	if(!b || !t || !m)
+	{
+		printf("out of memory for the layout benchmark, aborting\n");
+		exit(EXIT_FAILURE);
+	}
+	unsigned int seed = 1;
+	for(int y = 0; y < n; ++y)
+	{
+		for(int x = 0; x < n; ++x)
+		{
+			seed = seed * 1103515245 + 12345;
+			size_t c = benchCell<layout, bits>(x, y);
+			b[c] = 64 + ((x ^ y) & 63) + ((seed >> 16) & 7);
+			m[c] = ((seed >> 20) & 15) ? GRASS : DIRT;
 		}
+	}
 
-		out = fopen(fname, "wb");
-		checkError(out, fname);
+	int passes = (bits <= 10) ? 16 : 2;
+	perfBegin();
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for(int p = 0; p < passes; ++p)
+	{
+		for(int y = 1; y < n - 1; ++y)
+		{
+			for(int x = 1; x < n - 1; ++x)
+			{
+				unsigned char max = 0;
+				unsigned char v;
+				v = b[benchCell<layout, bits>(x, y - 1)] - 1; if(v > max) max = v;
+				v = b[benchCell<layout, bits>(x, y + 1)] - 1; if(v > max) max = v;
+				v = b[benchCell<layout, bits>(x - 1, y)] - 1; if(v > max) max = v;
+				v = b[benchCell<layout, bits>(x + 1, y)] - 1; if(v > max) max = v;
+				size_t c = benchCell<layout, bits>(x, y);
+				t[c] = (max < b[c]) ? max : b[c];
+			}
+		}
+		for(int y = 1; y < n - 1; ++y)
+		{
+			for(int x = 1; x < n - 1; ++x) b[benchCell<layout, bits>(x, y)] = t[benchCell<layout, bits>(x, y)];
+		}
+	}
+	*passMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / passes;
+	perfEnd(slot);
+	perfSlots[slot].cells = (double)passes * (n - 2) * (n - 2);
 
-		fwrite("\0\0", 1, 2, out);
-		for(int y = (i / 8) * 256; y < ((i / 8) + 1) * 256; ++y)
+	const int radius = 16;
+	const int scans = 4096;
+	long found = 0;
+	perfBegin();
+	start = std::chrono::steady_clock::now();
+	for(int k = 0; k < scans; ++k)
+	{
+		seed = seed * 1103515245 + 12345;
+		int cx = radius + (seed >> 8) % (n - 2 * radius);
+		seed = seed * 1103515245 + 12345;
+		int cy = radius + (seed >> 8) % (n - 2 * radius);
+		for(int y = cy - radius; y < cy + radius; ++y)
 		{
-			for(int x = (i % 8) * 256; x < ((i % 8) + 1) * 256; ++x)
+			for(int x = cx - radius; x < cx + radius; ++x)
 			{
-				fwrite(&bottom[y][x], 1, 1, out);
-				fwrite(&top[y][x], 1, 1, out);
-				fwrite(&material[y][x], 1, 1, out);
-				fwrite(&fraction[y][x], 1, 1, out);
+				int dx = x - cx;
+				int dy = y - cy;
+				if(dx * dx + dy * dy <= radius * radius && m[benchCell<layout, bits>(x, y)] != GRASS) found++;
 			}
 		}
-		fclose(out);
 	}
+	*scanMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	perfEnd(slot + 1);
+	perfSlots[slot + 1].cells = (double)scans * (2 * radius) * (2 * radius);
+	benchSink = found + t[benchCell<layout, bits>(1, 1)];
+	free(m);
+	free(t);
+	free(b);
+}
 
-	sprintf(fname, "%s/Monde_Arbre", outputDir);
-	out = fopen(fname, "wb");
+void runLayoutBench()
+{
+	const char* names[3] = {"rows", "tiles", "morton"};
+	void (*bench[2][3])(int, double*, double*) =
+	{
+		{benchLayout<0, 10>, benchLayout<1, 10>, benchLayout<2, 10>},
+		{benchLayout<0, 12>, benchLayout<1, 12>, benchLayout<2, 12>}
+	};
+	char text[2048];
+	text[0] = 0;
+	appendf(text, sizeof(text), "plane layouts (world built with %s)\n\n", names[PLANE_LAYOUT]);
+	appendf(text, sizeof(text), "%-8s %6s %16s %16s\n", "layout", "size", "bottom pass ms", "disk scans ms");
+	for(int size = 0; size < 2; ++size)
+	{
+		for(int layout = 0; layout < 3; ++layout)
+		{
+			double passMs, scanMs;
+			bench[size][layout](PERF_LAYOUT + (size * 3 + layout) * 2, &passMs, &scanMs);
+			appendf(text, sizeof(text), "%-8s %6d %16.2lf %16.2lf\n", names[layout], size ? 4096 : 1024, passMs, scanMs);
+		}
+	}
+	printf("%s", text);
+	char fname[600];
+	makeDirectory(outputDir);
+	snprintf(fname, sizeof(fname), "%s/layouts.txt", outputDir);
+	FILE* out = fopen(fname, "w");
 	checkError(out, fname);
-	fwrite(&trees[0], 4, treeNumber, out);
+	fputs(text, out);
 	fclose(out);
+	if(perfOut) printPerfReport();
+}
 
-	sprintf(fname, "%s/Monde_Doodads", outputDir);
-	out = fopen(fname, "wb");
-	checkError(out, fname);
-	fprintf(out, "StartingPoint %d ", startPoint);
-	for(int i = 0; i < crystalNumber; ++i)
+// benchmark corpus
+//
+// -bench runs every preset of a corpus file (lines "name parameters", # starts a
+// comment) as full generations without writing files. A round generates the
+// preset as N worlds at once through runTasks with -j N, for N = 1, 2, 4 ..
+// -benchj, every world with one thread, so the tables show how throughput scales
+// with concurrent worlds (the stages themselves only use threads in erosion).
+// Each round is repeated -benchn times and the fastest counts. Every world starts
+// from the command line parameters, so a preset only changes what it lists, seeds
+// it does not give are 0. Stage times come from the -perf timers (mean over the
+// worlds of a round), the output hash covers the region files, trees, doodads and
+// caves as writeFiles writes them and is the same for all worlds of a preset
+// unless a stage is not deterministic. bench.txt has the scaling and stage tables
+// and one "run" line per preset and world count; those lines of an earlier
+// bench.txt are the baseline for -benchbase. On systems without fork the worlds
+// of a round run one after the other in this process, so throughput does not
+// scale there and the presets should set every parameter an earlier one changed.
+
+#define BENCH_PRESETS 64
+#define BENCH_COUNTS 16
+#define BENCH_TOLERANCE 0.1   // time ratio against the baseline that is reported as a change
+#define BENCH_ARGS 128
+
+struct BenchPreset
+{
+	char name[32];
+	char args[480];
+};
+
+struct BenchRun
+{
+	int                status;
+	double             ms;                    // wall time of the round
+	double             stageMs[STAGE_COUNT];
+	unsigned long long hash;
+	int                same;                  // all worlds of the round had the hash
+};
+
+BenchPreset* benchPresets;
+int          benchPresetCount;
+int          benchPreset;                 // preset of the current round
+int          benchCounts[BENCH_COUNTS];   // worlds at once
+int          benchCountNumber;
+BenchRun*    benchRuns;                   // [preset][world count][round]
+BenchRun*    benchWorlds;                 // worlds of the current round, shared with the tasks
+
+// splits the parameters of a preset into args[1..], args[0] is its name and the
+// list ends with 0; returns the number of entries
+int benchArgs(const BenchPreset* p, char* text, char** args)
+{
+	int n = 1;
+	strcpy(text, p->args);
+	args[0] = (char*)p->name;
+	for(char* token = strtok(text, " \t"); token && n < BENCH_ARGS - 1; token = strtok(0, " \t")) args[n++] = token;
+	args[n] = 0;
+	return n;
+}
+
+void readBenchCorpus()
+{
+	FILE* in = fopen(benchCorpus, "r");
+	checkError(in, benchCorpus);
+	benchPresets = (BenchPreset*)calloc(BENCH_PRESETS, sizeof(BenchPreset));
+	char line[1024];
+	while(fgets(line, sizeof(line), in))
 	{
-		fprintf(out, "Crystal %d ", crystals[i]);
+		char* comment = strchr(line, '#');
+		if(comment) *comment = 0;
+		char name[32];
+		int n;
+		if(sscanf(line, "%31s%n", name, &n) != 1) continue;
+		if(benchPresetCount == BENCH_PRESETS)
+		{
+			printf("more than %d presets in %s, the rest is skipped\n", BENCH_PRESETS, benchCorpus);
+			break;
+		}
+		BenchPreset* p = &benchPresets[benchPresetCount++];
+		strcpy(p->name, name);
+		snprintf(p->args, sizeof(p->args), "%s", line + n + strspn(line + n, " \t"));
+		p->args[strcspn(p->args, "\r\n")] = 0;
+
+		// every option takes one value, a preset that ends with an option would
+		// make parseParameters read past its arguments
+		char text[480];
+		char* args[BENCH_ARGS];
+		int count = benchArgs(p, text, args);
+		for(int i = 1; i < count; i += 2)
+		{
+			if(args[i][0] != '-' || i + 1 == count)
+			{
+				printf("preset %s in %s: '%s' is not an option followed by a value\n", p->name, benchCorpus, args[i]);
+				exit(EXIT_FAILURE);
+			}
+		}
 	}
-	fclose(out);
+	fclose(in);
+	if(!benchPresetCount)
+	{
+		printf("no presets in %s\n", benchCorpus);
+		exit(EXIT_FAILURE);
+	}
+}
 
-	if(pgmOut) writePGMs();
-	if(infoOut) writeInfoFile();
+// hash of the files writeFiles would write for the current world
+unsigned long long benchHash()
+{
+	unsigned long long h = 0xcbf29ce484222325ull;
+	unsigned char* region = (unsigned char*)malloc(PACK_REGION_SIZE);
+	for(int i = 0; i < 28; ++i)
+	{
+		if(i % 8 > 3 || !regionWanted(i) || regionIsEmpty(i % 8, i / 8)) continue;
+		buildRegion(i, region);
+		h = (h ^ i ^ contentHash(region, PACK_REGION_SIZE)) * 0x100000001b3ull;
+	}
+	free(region);
+	size_t length;
+	char* doodads = formatDoodads(&length);
+	h = (h ^ contentHash(trees, 4 * treeNumber)) * 0x100000001b3ull;
+	h = (h ^ contentHash(doodads, length)) * 0x100000001b3ull;
+	free(doodads);
+	if(volumeThreshold < 1.0) h = (h ^ contentHash(volumeRuns, 8 * volumeRunCount)) * 0x100000001b3ull;
+	return h;
+}
+
+// world k of the current round
+void benchTask(int k)
+{
+	char text[480];
+	char* args[BENCH_ARGS];
+	int n = benchArgs(&benchPresets[benchPreset], text, args);
+	islandSeed = heightSeed = bottomSeed = treeSeed = treeSeedPos = crystalSeed = volumeSeed = 0;
+	parseParameters(n, args);
+	threads = 1;
+	freshWorld();
+	deadlineStart();
+
+	perfOut = 1;
+	memset(perfSlots, 0, sizeof(perfSlots));
+	runStages(STAGE_ISLAND, STAGE_CRYSTALS);
+	BenchRun* r = &benchWorlds[k];
+	for(int s = 0; s < STAGE_COUNT; ++s) r->stageMs[s] = perfSlots[s].ms;
+	r->hash = benchHash();
+	r->status = 1;
+}
+
+// fastest round of preset p at world count c, 0 if all failed
+const BenchRun* benchBest(int p, int c)
+{
+	const BenchRun* best = 0;
+	for(int r = 0; r < benchRepeat; ++r)
+	{
+		const BenchRun* run = &benchRuns[(p * benchCountNumber + c) * benchRepeat + r];
+		if(run->status == 1 && (!best || run->ms < best->ms)) best = run;
+	}
+	return best;
+}
+
+// compares the run lines of the baseline with the fastest rounds of this one
+void appendBenchBaseline(char* text, size_t size)
+{
+	size_t length;
+	unsigned char* base = readWholeFile(benchBase, &length);
+	if(!base)
+	{
+		printf("Could not read baseline %s\n", benchBase);
+		return;
+	}
+	char* copy = (char*)malloc(length + 1);
+	memcpy(copy, base, length);
+	copy[length] = 0;
+	free(base);
+	appendf(text, size, "\nagainst baseline %s\n\n", benchBase);
+	appendf(text, size, "%-20s %7s %12s %12s %7s %9s %8s\n", "preset", "worlds", "baseline ms", "ms", "ratio", "time", "output");
+	int compared = 0;
+	for(char* line = strtok(copy, "\n"); line; line = strtok(0, "\n"))
+	{
+		char name[32];
+		int count;
+		double ms;
+		unsigned long long hash;
+		if(sscanf(line, "run %31s %d %lf %*f %*f %*f %*f %*f %*f %*f %llx", name, &count, &ms, &hash) != 4) continue;
+		for(int p = 0; p < benchPresetCount; ++p)
+		{
+			if(strcmp(benchPresets[p].name, name)) continue;
+			for(int c = 0; c < benchCountNumber; ++c)
+			{
+				const BenchRun* run = benchBest(p, c);
+				if(benchCounts[c] != count || !run) continue;
+				double ratio = run->ms / ms;
+				const char* change = (ratio > 1.0 + BENCH_TOLERANCE) ? "slower" : (ratio < 1.0 - BENCH_TOLERANCE) ? "faster" : "same";
+				appendf(text, size, "%-20s %7d %12.1lf %12.1lf %7.2lf %9s %8s\n", name, count, ms, run->ms, ratio, change,
+				        run->hash == hash ? "same" : "CHANGED");
+				compared++;
+			}
+		}
+	}
+	if(!compared) appendf(text, size, "no preset and world count in common\n");
+	free(copy);
+}
+
+void runBench()
+{
+	readBenchCorpus();
+	int most = benchThreads > 0 ? benchThreads : threads;
+	for(int t = 1; t < most && benchCountNumber < BENCH_COUNTS - 1; t *= 2) benchCounts[benchCountNumber++] = t;
+	benchCounts[benchCountNumber++] = most;
+	if(benchRepeat < 1) benchRepeat = 1;
+
+	int rounds = benchPresetCount * benchCountNumber * benchRepeat;
+	printf("benchmark: %d presets at %d world counts, %d rounds: ", benchPresetCount, benchCountNumber, rounds);
+	benchRuns = (BenchRun*)calloc(rounds, sizeof(BenchRun));
+	benchWorlds = (BenchRun*)sharedAlloc(most * sizeof(BenchRun));
+	int jobs = threads;
+	for(int k = 0; k < rounds; ++k)
+	{
+		int count = benchCounts[k / benchRepeat % benchCountNumber];
+		benchPreset = k / benchRepeat / benchCountNumber;
+		memset(benchWorlds, 0, most * sizeof(BenchRun));
+		threads = count;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		runTasks(count, benchTask, 1);
+		BenchRun* r = &benchRuns[k];
+		r->ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		r->status = 1;
+		r->same = 1;
+		r->hash = benchWorlds[0].hash;
+		for(int w = 0; w < count; ++w)
+		{
+			if(benchWorlds[w].status != 1) r->status = 0;
+			if(benchWorlds[w].hash != r->hash) r->same = 0;
+			for(int s = 0; s < STAGE_COUNT; ++s) r->stageMs[s] += benchWorlds[w].stageMs[s] / count;
+		}
+		printf(".");
+		fflush(stdout);
+	}
+	threads = jobs;
 	printf(" done.\n");
+
+	size_t size = 4096 + benchPresetCount * (benchCountNumber + 2) * 512;
+	char* text = (char*)malloc(size);
+	text[0] = 0;
+	appendf(text, size, "benchmark corpus %s, fastest of %d rounds, N worlds generated at once\n\n", benchCorpus, benchRepeat);
+
+	appendf(text, size, "worlds per second\n\n%-20s", "preset");
+	for(int c = 0; c < benchCountNumber; ++c) appendf(text, size, " %6d at once", benchCounts[c]);
+	appendf(text, size, " %8s %8s\n", "scaling", "output");
+	for(int p = 0; p < benchPresetCount; ++p)
+	{
+		appendf(text, size, "%-20s", benchPresets[p].name);
+		const BenchRun* first = benchBest(p, 0);
+		const BenchRun* last = benchBest(p, benchCountNumber - 1);
+		int same = 1;
+		for(int c = 0; c < benchCountNumber; ++c)
+		{
+			const BenchRun* run = benchBest(p, c);
+			if(run) appendf(text, size, " %14.2lf", benchCounts[c] * 1000.0 / run->ms);
+			else appendf(text, size, " %14s", "failed");
+			if(!run || !first || !run->same || run->hash != first->hash) same = 0;
+		}
+		// throughput at the most worlds against one world
+		if(first && last) appendf(text, size, " %8.2lf", most * first->ms / last->ms);
+		else appendf(text, size, " %8s", "-");
+		appendf(text, size, " %8s\n", same ? "same" : "DIFFERS");
+	}
+
+	if(benchCountNumber > 1) appendf(text, size, "\nstage ms per world at %d and %d worlds at once\n\n", benchCounts[0], most);
+	else appendf(text, size, "\nstage ms per world at %d worlds at once\n\n", most);
+	appendf(text, size, "%-20s %7s", "preset", "worlds");
+	for(int s = 0; s < STAGE_COUNT; ++s) appendf(text, size, " %9s", perfSlotName[s]);
+	appendf(text, size, "\n");
+	for(int p = 0; p < benchPresetCount; ++p)
+	{
+		for(int c = 0; c < benchCountNumber; c += MAX(benchCountNumber - 1, 1))
+		{
+			const BenchRun* run = benchBest(p, c);
+			if(!run) continue;
+			appendf(text, size, "%-20s %7d", benchPresets[p].name, benchCounts[c]);
+			for(int s = 0; s < STAGE_COUNT; ++s) appendf(text, size, " %9.1lf", run->stageMs[s]);
+			appendf(text, size, "\n");
+		}
+	}
+
+	if(strcmp(benchBase, "")) appendBenchBaseline(text, size);
+
+	appendf(text, size, "\nruns: preset, worlds at once, ms of the round, stage ms per world (");
+	for(int s = 0; s < STAGE_COUNT; ++s) appendf(text, size, s ? " %s" : "%s", perfSlotName[s]);
+	appendf(text, size, "), output hash\n");
+	for(int p = 0; p < benchPresetCount; ++p)
+	{
+		for(int c = 0; c < benchCountNumber; ++c)
+		{
+			const BenchRun* run = benchBest(p, c);
+			if(!run) continue;
+			appendf(text, size, "run %s %d %.2lf", benchPresets[p].name, benchCounts[c], run->ms);
+			for(int s = 0; s < STAGE_COUNT; ++s) appendf(text, size, " %.2lf", run->stageMs[s]);
+			appendf(text, size, " %016llx\n", run->hash);
+		}
+	}
+
+	printf("%s", text);
+	char fname[600];
+	makeDirectory(outputDir);
+	snprintf(fname, sizeof(fname), "%s/bench.txt", outputDir);
+	FILE* out = fopen(fname, "w");
+	checkError(out, fname);
+	fputs(text, out);
+	fclose(out);
+	free(text);
+	sharedFree(benchWorlds, most * sizeof(BenchRun));
+	free(benchRuns);
+	free(benchPresets);
 }
 
 int main(int argc, char** argv)
@@ -662,11 +4836,114 @@ int main(int argc, char** argv)
 	checkHelp(argc, argv);
 	initialize();
 	readParameters(argc, argv);
-	generateIsland();
-	generateTop();
-	roundEdges();
-	generateBottom();
-	plantTrees();
-	growCrystals();
-	writeFiles();
+	if(strcmp(loadSource, ""))
+	{
+		loadParameters();
+		readParameters(argc, argv);
+	}
+	if(strcmp(graphFile, "")) readGraphFile();
+	if(strcmp(packSource, ""))
+	{
+		if(packDirectory(packSource, outputDir, packRle))
+		{
+			printf("Could not pack %s into %s\n", packSource, outputDir);
+			exit(EXIT_FAILURE);
+		}
+		exit(EXIT_SUCCESS);
+	}
+	if(strcmp(unpackSource, ""))
+	{
+		if(unpackToDirectory(unpackSource, outputDir))
+		{
+			printf("Could not unpack %s into %s\n", unpackSource, outputDir);
+			exit(EXIT_FAILURE);
+		}
+		exit(EXIT_SUCCESS);
+	}
+	if(layoutBench)
+	{
+		if(perfOut) perfOpen();
+		runLayoutBench();
+		exit(EXIT_SUCCESS);
+	}
+	World* w = acquireWorld();
+	bindWorld(w);
+	if(perfOut) perfOpen();
+	if(strcmp(layerDir, "")) makeDirectory(layerDir);
+	deadlineStart();
+	if(layerCache && (batchCount > 0 || searchCount > 0))
+	{
+		printf("-lc and -lcdir keep layers for sweeps and reruns, the worlds of -batch, -queue and -search\n"
+		       "are generated in separate processes that would fill them and throw them away\n");
+		exit(EXIT_FAILURE);
+	}
+	if(volumeThreshold < 1.0 && packOut)
+	{
+		printf("packed containers have no place for the caves (Monde_Volume), -vt needs a world directory\n");
+		exit(EXIT_FAILURE);
+	}
+	if(regionMask && packOut)
+	{
+		printf("-region leaves the other regions alone, a packed container can not do that (-pack)\n");
+		exit(EXIT_FAILURE);
+	}
+	if(incremental && packOut)
+	{
+		printf("-inc writes world directories, it does not work with -pack\n");
+		exit(EXIT_FAILURE);
+	}
+	if(queueSize > 0 && batchCount < 1)
+	{
+		printf("-queue needs the number of worlds (-batch)\n");
+		exit(EXIT_FAILURE);
+	}
+	if(strcmp(benchCorpus, ""))
+	{
+		runBench();
+		releaseWorld(w);
+		return 0;
+	}
+	if(batchCount > 0)
+	{
+		if(queueSize > 0) runQueue();
+		else runBatch();
+		saveLayers();
+		releaseWorld(world);
+		return 0;
+	}
+	if(searchCount > 0)
+	{
+		runSearch();
+		releaseWorld(world);
+		return 0;
+	}
+	if(strcmp(sweepSpec, ""))
+	{
+		parseSweep();
+		runSweep();
+		saveLayers();
+		releaseWorld(w);
+		return 0;
+	}
+	if(strcmp(loadSource, ""))
+	{
+		perfBegin();
+		loadWorld();
+		perfEnd(PERF_LOAD);
+	}
+	else
+	{
+		runStages(STAGE_ISLAND, STAGE_BOTTOM);
+	}
+	runStages(STAGE_VOLUME, STAGE_CRYSTALS);
+	perfBegin();
+	if(packOut) writePackFile();
+	else writeFiles();
+	perfEnd(PERF_WRITE);
+	if(adaptiveQuality) adaptiveReport();
+	if(memoryReport) printMemoryReport();
+	if(memoryReport && layerCache) printLayerReport();
+	if(perfOut) printPerfReport();
+	saveLayers();
+	releaseWorld(w);
 }
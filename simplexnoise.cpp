@@ -21,6 +21,12 @@
 
 #include "simplexnoise.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
 // The gradients are the midpoints of the vertices of a cube.
 static const int grad3[12][3] = {
@@ -86,6 +92,11 @@ static const int simplex[64][4] = {
 };
 
 
+// Skewing and unskewing factors for 2D, computed once instead of per sample.
+static const double F2 = 0.5 * (sqrtf(3.0) - 1.0);
+static const double G2 = (3.0 - sqrtf(3.0)) / 6.0;
+
+
 int fastfloor( const double x ) { return x > 0 ? (int) x : (int) x - 1; }
 
 double dot( const int* g, const double x, const double y ) { return g[0]*x + g[1]*y; }
@@ -202,6 +213,319 @@ double scaled_octave_noise_4d( const int octaves, const double persistence, cons
 
 
 
+// 2D Multi-octave Simplex noise with the octave count fixed at compile time.
+//
+// Frequencies, amplitudes and the normalization come from the setup, the loop
+// is unrolled and raw_noise_2d() is inlined into it.
+template <int octaves>
+static double octave_noise_2d_fixed( const octave_noise_2d_setup* setup, const double x, const double y ) {
+    double total = 0;
+
+    for( int i=0; i < octaves; i++ ) {
+        total += raw_noise_2d( x * setup->frequency[i], y * setup->frequency[i] ) * setup->amplitude[i];
+    }
+
+    return total / setup->maxAmplitude;
+}
+
+
+// 2D Multi-octave Simplex noise fallback for octave counts without a fixed kernel.
+static double octave_noise_2d_generic( const octave_noise_2d_setup* setup, const double x, const double y ) {
+    return octave_noise_2d(setup->octaves, setup->persistence, setup->scale, x, y);
+}
+
+
+// Precompute a 2D Multi-octave Simplex noise setup.
+//
+// The amplitudes and their sum are accumulated exactly like octave_noise_2d() does,
+// so both paths return bit-identical values.
+void init_octave_noise_2d( octave_noise_2d_setup* setup, const int octaves, const double persistence, const double scale ) {
+    static double (* const kernels[OCTAVE_NOISE_MAX_FIXED + 1])(const octave_noise_2d_setup*, const double, const double) = {
+        octave_noise_2d_generic,
+        octave_noise_2d_fixed<1>, octave_noise_2d_fixed<2>, octave_noise_2d_fixed<3>, octave_noise_2d_fixed<4>,
+        octave_noise_2d_fixed<5>, octave_noise_2d_fixed<6>, octave_noise_2d_fixed<7>, octave_noise_2d_fixed<8>
+    };
+
+    double frequency = scale;
+    double amplitude = 1;
+    double maxAmplitude = 0;
+
+    setup->octaves = octaves;
+    setup->persistence = persistence;
+    setup->scale = scale;
+    for( int i=0; i < octaves; i++ ) {
+        if( i < OCTAVE_NOISE_MAX_FIXED ) {
+            setup->frequency[i] = frequency;
+            setup->amplitude[i] = amplitude;
+        }
+
+        frequency *= 2;
+        maxAmplitude += amplitude;
+        amplitude *= persistence;
+    }
+    setup->maxAmplitude = maxAmplitude;
+    setup->kernel = (octaves > 0 && octaves <= OCTAVE_NOISE_MAX_FIXED) ? kernels[octaves] : kernels[0];
+}
+
+
+// 2D Multi-octave Simplex noise from a precomputed setup.
+double octave_noise_2d( const octave_noise_2d_setup* setup, const double x, const double y ) {
+    return setup->kernel(setup, x, y);
+}
+
+
+// 2D Scaled Multi-octave Simplex noise from a precomputed setup.
+//
+// Returned value will be between loBound and hiBound.
+double scaled_octave_noise_2d( const octave_noise_2d_setup* setup, const double loBound, const double hiBound, const double x, const double y ) {
+    return setup->kernel(setup, x, y) * (hiBound - loBound) / 2 + (hiBound + loBound) / 2;
+}
+
+
+
+// 2D Multi-octave Simplex noise threshold test from a precomputed setup.
+//
+// The largest magnitude raw_noise_2d() can reach is about 0.998, so after each
+// octave the final sum is known to lie within the partial sum plus or minus the
+// amplitudes still missing. Amplitudes and the sum are accumulated in the same
+// order as octave_noise_2d(), so a full evaluation returns the identical value.
+int octave_noise_2d_classify( const octave_noise_2d_setup* setup, const double x, const double y, const double lo, const double hi, double* value ) {
+    double total = 0;
+    double frequency = setup->scale;
+    double amplitude = 1;
+    double remaining = setup->maxAmplitude;
+
+    for( int i=0; i < setup->octaves; i++ ) {
+        if( (total + remaining) / setup->maxAmplitude < lo ) return -1;
+        if( (total - remaining) / setup->maxAmplitude > hi ) return 1;
+
+        total += raw_noise_2d( x * frequency, y * frequency ) * amplitude;
+
+        frequency *= 2;
+        remaining -= amplitude;
+        amplitude *= setup->persistence;
+    }
+
+    *value = total / setup->maxAmplitude;
+    return 0;
+}
+
+
+// 3D raw Simplex noise for NOISE_LANES points (x, y, z[l]) at once.
+// The skew, the simplex order and the corner contributions are done in 4 (AVX2)
+// or 2 (SSE2) lanes of doubles, only the permutation hashes are looked up per
+// lane. The operations are the ones of raw_noise_3d in the same order, so the
+// values are identical to it, except in the last bit where the compiler fuses
+// multiply-adds (-mfma) differently in the two. fastfloor is trunc minus 1 where x <= 0.
+#if defined(__AVX2__)
+#define NOISE_LANES 4
+typedef __m256d noise_v;
+#define V_SET(a)        _mm256_set1_pd(a)
+#define V_LOAD(p)       _mm256_loadu_pd(p)
+#define V_STORE(p, a)   _mm256_storeu_pd(p, a)
+#define V_ADD(a, b)     _mm256_add_pd(a, b)
+#define V_SUB(a, b)     _mm256_sub_pd(a, b)
+#define V_MUL(a, b)     _mm256_mul_pd(a, b)
+#define V_AND(a, b)     _mm256_and_pd(a, b)
+#define V_ANDNOT(a, b)  _mm256_andnot_pd(a, b)
+#define V_OR(a, b)      _mm256_or_pd(a, b)
+#define V_GE(a, b)      _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+#define V_LT(a, b)      _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define V_LE(a, b)      _mm256_cmp_pd(a, b, _CMP_LE_OQ)
+#define V_BITS(a)       _mm256_movemask_pd(a)
+#define V_TRUNC(a)      _mm256_cvttpd_epi32(a)
+#define V_FROM_INT(a)   _mm256_cvtepi32_pd(a)
+#define V_STORE_INT(p, a) _mm_storeu_si128((__m128i*)(p), a)
+#elif defined(__SSE2__)
+#define NOISE_LANES 2
+typedef __m128d noise_v;
+#define V_SET(a)        _mm_set1_pd(a)
+#define V_LOAD(p)       _mm_loadu_pd(p)
+#define V_STORE(p, a)   _mm_storeu_pd(p, a)
+#define V_ADD(a, b)     _mm_add_pd(a, b)
+#define V_SUB(a, b)     _mm_sub_pd(a, b)
+#define V_MUL(a, b)     _mm_mul_pd(a, b)
+#define V_AND(a, b)     _mm_and_pd(a, b)
+#define V_ANDNOT(a, b)  _mm_andnot_pd(a, b)
+#define V_OR(a, b)      _mm_or_pd(a, b)
+#define V_GE(a, b)      _mm_cmpge_pd(a, b)
+#define V_LT(a, b)      _mm_cmplt_pd(a, b)
+#define V_LE(a, b)      _mm_cmple_pd(a, b)
+#define V_BITS(a)       _mm_movemask_pd(a)
+#define V_TRUNC(a)      _mm_cvttpd_epi32(a)
+#define V_FROM_INT(a)   _mm_cvtepi32_pd(a)
+#define V_STORE_INT(p, a) _mm_storel_epi64((__m128i*)(p), a)
+#else
+#define NOISE_LANES 1
+#endif
+
+#if NOISE_LANES > 1
+static inline noise_v fastfloor_lanes( const noise_v x ) {
+    return V_SUB( V_FROM_INT(V_TRUNC(x)), V_AND(V_LE(x, V_SET(0.0)), V_SET(1.0)) );
+}
+
+static inline noise_v corner_lanes( const noise_v x, const noise_v y, const noise_v z, const double* g ) {
+    noise_v t = V_SUB( V_SUB( V_SUB(V_SET(0.6), V_MUL(x, x)), V_MUL(y, y) ), V_MUL(z, z) );
+    noise_v d = V_ADD( V_ADD( V_MUL(V_LOAD(g), x), V_MUL(V_LOAD(g + NOISE_LANES), y) ), V_MUL(V_LOAD(g + 2 * NOISE_LANES), z) );
+    noise_v tt = V_MUL(t, t);
+    return V_ANDNOT( V_LT(t, V_SET(0.0)), V_MUL(V_MUL(tt, tt), d) );
+}
+
+static void raw_noise_3d_lanes( const double x, const double y, const double* z, double* value ) {
+    const double F3 = 1.0/3.0;
+    const double G3 = 1.0/6.0;
+    const noise_v one = V_SET(1.0);
+    noise_v vx = V_SET(x);
+    noise_v vy = V_SET(y);
+    noise_v vz = V_LOAD(z);
+
+    noise_v s = V_MUL( V_ADD(V_ADD(vx, vy), vz), V_SET(F3) );
+    noise_v i = fastfloor_lanes( V_ADD(vx, s) );
+    noise_v j = fastfloor_lanes( V_ADD(vy, s) );
+    noise_v k = fastfloor_lanes( V_ADD(vz, s) );
+    noise_v t = V_MUL( V_ADD(V_ADD(i, j), k), V_SET(G3) );
+    noise_v x0 = V_SUB( vx, V_SUB(i, t) );
+    noise_v y0 = V_SUB( vy, V_SUB(j, t) );
+    noise_v z0 = V_SUB( vz, V_SUB(k, t) );
+
+    // The simplex order of raw_noise_3d as masks: the second corner steps along
+    // the largest of x0, y0, z0, the third corner along all but the smallest.
+    noise_v xy = V_GE(x0, y0);
+    noise_v xz = V_GE(x0, z0);
+    noise_v yz = V_GE(y0, z0);
+    noise_v m1i = V_AND(xy, xz);
+    noise_v m1j = V_ANDNOT(xy, yz);
+    noise_v m2i = V_OR(xy, xz);
+    noise_v m2j = V_OR(V_LT(x0, y0), yz);
+    noise_v i1 = V_AND(m1i, one);
+    noise_v j1 = V_AND(m1j, one);
+    noise_v k1 = V_SUB( V_SUB(one, i1), j1 );
+    noise_v i2 = V_AND(m2i, one);
+    noise_v j2 = V_AND(m2j, one);
+    noise_v k2 = V_SUB( V_SUB(V_SET(2.0), i2), j2 );
+
+    int ci[NOISE_LANES], cj[NOISE_LANES], ck[NOISE_LANES];
+    V_STORE_INT( ci, V_TRUNC(i) );
+    V_STORE_INT( cj, V_TRUNC(j) );
+    V_STORE_INT( ck, V_TRUNC(k) );
+    int b1i = V_BITS(m1i), b1j = V_BITS(m1j), b2i = V_BITS(m2i), b2j = V_BITS(m2j);
+
+    // gradients of the 4 corners, x, y and z components of all lanes in a row
+    double g[4][3 * NOISE_LANES];
+    for( int l=0; l < NOISE_LANES; l++ ) {
+        int ii = ci[l] & 255;
+        int jj = cj[l] & 255;
+        int kk = ck[l] & 255;
+        int oi1 = (b1i >> l) & 1, oj1 = (b1j >> l) & 1, ok1 = 1 - oi1 - oj1;
+        int oi2 = (b2i >> l) & 1, oj2 = (b2j >> l) & 1, ok2 = 2 - oi2 - oj2;
+        int gi[4] = {
+            perm[ii+perm[jj+perm[kk]]] % 12,
+            perm[ii+oi1+perm[jj+oj1+perm[kk+ok1]]] % 12,
+            perm[ii+oi2+perm[jj+oj2+perm[kk+ok2]]] % 12,
+            perm[ii+1+perm[jj+1+perm[kk+1]]] % 12
+        };
+        for( int c=0; c < 4; c++ ) {
+            g[c][l] = grad3[gi[c]][0];
+            g[c][l + NOISE_LANES] = grad3[gi[c]][1];
+            g[c][l + 2 * NOISE_LANES] = grad3[gi[c]][2];
+        }
+    }
+
+    noise_v n0 = corner_lanes( x0, y0, z0, g[0] );
+    noise_v n1 = corner_lanes( V_ADD(V_SUB(x0, i1), V_SET(G3)), V_ADD(V_SUB(y0, j1), V_SET(G3)), V_ADD(V_SUB(z0, k1), V_SET(G3)), g[1] );
+    noise_v n2 = corner_lanes( V_ADD(V_SUB(x0, i2), V_SET(2.0*G3)), V_ADD(V_SUB(y0, j2), V_SET(2.0*G3)), V_ADD(V_SUB(z0, k2), V_SET(2.0*G3)), g[2] );
+    noise_v n3 = corner_lanes( V_ADD(V_SUB(x0, one), V_SET(3.0*G3)), V_ADD(V_SUB(y0, one), V_SET(3.0*G3)), V_ADD(V_SUB(z0, one), V_SET(3.0*G3)), g[3] );
+
+    V_STORE( value, V_MUL(V_SET(32.0), V_ADD(V_ADD(V_ADD(n0, n1), n2), n3)) );
+}
+#endif
+
+
+// Threshold test of 3D Multi-octave Simplex noise along a column from a precomputed setup.
+//
+// The octaves are the outer loop, so every octave runs over the column with the
+// same frequency and amplitude. Points that the remaining octaves can no longer
+// move across the threshold are dropped from the later octaves, the ones still
+// open are gathered and evaluated NOISE_LANES at a time by raw_noise_3d_lanes.
+void octave_noise_3d_column( const octave_noise_2d_setup* setup, const double x, const double y, const double z0, const double dz, const int count, const double threshold, unsigned char* above ) {
+    double total[256];
+    unsigned char open[256];
+    int index[256];
+    double z[256];
+    double noise[256];
+    double frequency = setup->scale;
+    double amplitude = 1;
+    double remaining = setup->maxAmplitude;
+    double level = threshold * setup->maxAmplitude;
+
+    for( int i=0; i < count; i++ ) {
+        total[i] = 0;
+        open[i] = 1;
+        above[i] = 0;
+    }
+    for( int o=0; o < setup->octaves; o++ ) {
+        int pending = 0;
+        for( int i=0; i < count; i++ ) {
+            if( !open[i] ) continue;
+            if( total[i] - remaining > level ) {
+                above[i] = 1;
+                open[i] = 0;
+                continue;
+            }
+            if( total[i] + remaining <= level ) {
+                open[i] = 0;
+                continue;
+            }
+            index[pending] = i;
+            z[pending] = (z0 + i * dz) * frequency;
+            pending++;
+        }
+        if( !pending ) return;
+
+        int m = 0;
+#if NOISE_LANES > 1
+        for( ; m + NOISE_LANES <= pending; m += NOISE_LANES ) raw_noise_3d_lanes( x * frequency, y * frequency, z + m, noise + m );
+#endif
+        for( ; m < pending; m++ ) noise[m] = raw_noise_3d( x * frequency, y * frequency, z[m] );
+        for( m=0; m < pending; m++ ) total[index[m]] += noise[m] * amplitude;
+
+        frequency *= 2;
+        remaining -= amplitude;
+        amplitude *= setup->persistence;
+    }
+    for( int i=0; i < count; i++ ) {
+        if( open[i] ) above[i] = total[i] > level;
+    }
+}
+
+
+// 2D Multi-octave Simplex noise with analytic gradient from a precomputed setup.
+//
+// Each octave contributes its raw gradient times frequency and amplitude.
+double octave_noise_2d_deriv( const octave_noise_2d_setup* setup, const double x, const double y, double* dx, double* dy ) {
+    double total = 0;
+    double totalDx = 0;
+    double totalDy = 0;
+    double frequency = setup->scale;
+    double amplitude = 1;
+
+    for( int i=0; i < setup->octaves; i++ ) {
+        double ndx, ndy;
+        total += raw_noise_2d_deriv( x * frequency, y * frequency, &ndx, &ndy ) * amplitude;
+        totalDx += ndx * frequency * amplitude;
+        totalDy += ndy * frequency * amplitude;
+
+        frequency *= 2;
+        amplitude *= setup->persistence;
+    }
+
+    *dx = totalDx / setup->maxAmplitude;
+    *dy = totalDy / setup->maxAmplitude;
+    return total / setup->maxAmplitude;
+}
+
+
+
 // 2D Scaled Simplex raw noise.
 //
 // Returned value will be between loBound and hiBound.
@@ -232,13 +556,11 @@ double raw_noise_2d( const double x, const double y ) {
     double n0, n1, n2;
 
     // Skew the input space to determine which simplex cell we're in
-    double F2 = 0.5 * (sqrtf(3.0) - 1.0);
     // Hairy factor for 2D
     double s = (x + y) * F2;
     int i = fastfloor( x + s );
     int j = fastfloor( y + s );
 
-    double G2 = (3.0 - sqrtf(3.0)) / 6.0;
     double t = (i + j) * G2;
     // Unskew the cell origin back to (x,y) space
     double X0 = i-t;
@@ -296,6 +618,56 @@ double raw_noise_2d( const double x, const double y ) {
 }
 
 
+// 2D raw Simplex noise with analytic gradient
+//
+// Every corner contributes t^4 * (g . d) with t = 0.5 - |d|^2, so its gradient is
+// t^4 * g - 8 * t^3 * (g . d) * d. The value is computed exactly like raw_noise_2d().
+double raw_noise_2d_deriv( const double x, const double y, double* dx, double* dy ) {
+    double s = (x + y) * F2;
+    int i = fastfloor( x + s );
+    int j = fastfloor( y + s );
+
+    double t = (i + j) * G2;
+    double x0 = x-(i-t);
+    double y0 = y-(j-t);
+
+    int i1, j1;
+    if(x0>y0) {i1=1; j1=0;}
+    else {i1=0; j1=1;}
+
+    double xs[3] = { x0, x0 - i1 + G2, x0 - 1.0 + 2.0 * G2 };
+    double ys[3] = { y0, y0 - j1 + G2, y0 - 1.0 + 2.0 * G2 };
+
+    int ii = i & 255;
+    int jj = j & 255;
+    int gi[3] = {
+        perm[ii+perm[jj]] % 12,
+        perm[ii+i1+perm[jj+j1]] % 12,
+        perm[ii+1+perm[jj+1]] % 12
+    };
+
+    double n[3];
+    double gx = 0;
+    double gy = 0;
+    for( int c=0; c < 3; c++ ) {
+        double tc = 0.5 - xs[c]*xs[c]-ys[c]*ys[c];
+        if(tc<0) n[c] = 0.0;
+        else {
+            double t2 = tc * tc;
+            double t4 = t2 * t2;
+            double gd = dot(grad3[gi[c]], xs[c], ys[c]);
+            n[c] = t4 * gd;
+            gx += t4 * grad3[gi[c]][0] - 8.0 * t2 * tc * gd * xs[c];
+            gy += t4 * grad3[gi[c]][1] - 8.0 * t2 * tc * gd * ys[c];
+        }
+    }
+
+    *dx = 70.0 * gx;
+    *dy = 70.0 * gy;
+    return 70.0 * (n[0] + n[1] + n[2]);
+}
+
+
 // 3D raw Simplex noise
 double raw_noise_3d( const double x, const double y, const double z ) {
     double n0, n1, n2, n3; // Noise contributions from the four corners
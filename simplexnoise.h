@@ -52,6 +52,10 @@ double raw_noise_2d(const double x, const double y);
 double raw_noise_3d(const double x, const double y, const double z);
 double raw_noise_4d(const double x, const double y, const double, const double w);
 
+// Raw Simplex noise with analytic gradient - the value is identical to raw_noise_2d,
+// the partial derivatives with respect to x and y are stored in *dx and *dy.
+double raw_noise_2d_deriv(const double x, const double y, double* dx, double* dy);
+
 
 // Scaled Raw Simplex noise
 // The result will be between the two parameters passed.
@@ -123,4 +127,67 @@ double scaled_octave_noise_4d(  const int octaves,
                             const double w);
 
 
+// Precomputed 2D Multi-octave Simplex noise
+// When the same octaves/persistence/scale are used for a whole field, the per
+// octave frequencies and amplitudes and the normalization are computed once by
+// init_octave_noise_2d(). Octave counts up to OCTAVE_NOISE_MAX_FIXED use a kernel
+// specialized at compile time, everything else falls back to octave_noise_2d().
+// Results are identical to the plain functions with the same parameters.
+#define OCTAVE_NOISE_MAX_FIXED 8
+
+struct octave_noise_2d_setup {
+    int octaves;
+    double persistence;
+    double scale;
+    double frequency[OCTAVE_NOISE_MAX_FIXED];
+    double amplitude[OCTAVE_NOISE_MAX_FIXED];
+    double maxAmplitude;
+    double (*kernel)(const octave_noise_2d_setup* setup, const double x, const double y);
+};
+
+void init_octave_noise_2d(  octave_noise_2d_setup* setup,
+                            const int octaves,
+                            const double persistence,
+                            const double scale);
+double octave_noise_2d(     const octave_noise_2d_setup* setup,
+                            const double x,
+                            const double y);
+double scaled_octave_noise_2d(  const octave_noise_2d_setup* setup,
+                            const double loBound,
+                            const double hiBound,
+                            const double x,
+                            const double y);
+
+// Threshold test of Multi-octave Simplex noise from a precomputed setup.
+// Octaves are added until the remaining ones (each |raw noise| <= 1) can no longer
+// move the sum across [lo, hi]. Returns -1 if the value is certainly below lo,
+// 1 if it is certainly above hi, otherwise 0 with the exact octave_noise_2d value in *value.
+int octave_noise_2d_classify(   const octave_noise_2d_setup* setup,
+                            const double x,
+                            const double y,
+                            const double lo,
+                            const double hi,
+                            double* value);
+
+// Threshold test of 3D Multi-octave Simplex noise for count (at most 256) points
+// (x, y, z0 + i * dz) along a column, with octaves, persistence and scale from a
+// setup of init_octave_noise_2d. above[i] is 1 where octave_noise_3d is above threshold.
+void octave_noise_3d_column(    const octave_noise_2d_setup* setup,
+                            const double x,
+                            const double y,
+                            const double z0,
+                            const double dz,
+                            const int count,
+                            const double threshold,
+                            unsigned char* above);
+
+// Multi-octave Simplex noise with analytic gradient from a precomputed setup.
+// The value is identical to octave_noise_2d, the gradient is with respect to x and y.
+double octave_noise_2d_deriv(   const octave_noise_2d_setup* setup,
+                            const double x,
+                            const double y,
+                            double* dx,
+                            double* dy);
+
+
 #endif /*SIMPLEX_H_*/
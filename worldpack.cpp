@@ -0,0 +1,404 @@
+/* Copyright (c) 2012 Manuel Kasten
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "worldpack.h"
+
+#define PACK_HEADER 448
+#define PACK_ALIGN 4096
+
+static const char* blobName[3] = {"Monde_Arbre", "Monde_Doodads", "csworldgen.info"};
+
+int packRegionNumber(int index)
+{
+	return (index / 4) * 8 + index % 4;
+}
+
+static void put32(unsigned char* p, unsigned int v)
+{
+	for(int i = 0; i < 4; ++i) p[i] = v >> (8 * i);
+}
+
+static void put64(unsigned char* p, unsigned long long v)
+{
+	for(int i = 0; i < 8; ++i) p[i] = v >> (8 * i);
+}
+
+static unsigned int get32(const unsigned char* p)
+{
+	unsigned int v = 0;
+	for(int i = 3; i >= 0; --i) v = (v << 8) | p[i];
+	return v;
+}
+
+static unsigned long long get64(const unsigned char* p)
+{
+	unsigned long long v = 0;
+	for(int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+	return v;
+}
+
+// run length codes the cells of a region into out (worst case 2 + cells * 4 + cells / 128 + 1)
+static size_t encodeRegion(const unsigned char* in, unsigned char* out)
+{
+	size_t n = 0;
+	out[n++] = in[0];
+	out[n++] = in[1];
+	const unsigned char* c = in + 2;
+	int count = 256 * 256;
+	int i = 0;
+	while(i < count)
+	{
+		int run = 1;
+		while(i + run < count && run < 129 && !memcmp(c + 4 * i, c + 4 * (i + run), 4)) run++;
+		if(run >= 2)
+		{
+			out[n++] = run + 126;
+			memcpy(out + n, c + 4 * i, 4);
+			n += 4;
+			i += run;
+			continue;
+		}
+		// literals until the next run of two or the block is full
+		int start = i;
+		int literal = 0;
+		while(i < count && literal < 128)
+		{
+			if(i + 1 < count && !memcmp(c + 4 * i, c + 4 * (i + 1), 4)) break;
+			i++;
+			literal++;
+		}
+		out[n++] = literal - 1;
+		memcpy(out + n, c + 4 * start, 4 * literal);
+		n += 4 * literal;
+	}
+	return n;
+}
+
+static int decodeRegion(const unsigned char* in, size_t size, unsigned char* out)
+{
+	if(size < 2) return 1;
+	out[0] = in[0];
+	out[1] = in[1];
+	unsigned char* c = out + 2;
+	int count = 256 * 256;
+	int i = 0;
+	size_t n = 2;
+	while(i < count && n < size)
+	{
+		int control = in[n++];
+		if(control < 128)
+		{
+			int literal = control + 1;
+			if(i + literal > count || n + 4 * literal > size) return 1;
+			memcpy(c + 4 * i, in + n, 4 * literal);
+			n += 4 * literal;
+			i += literal;
+		}
+		else
+		{
+			int run = control - 126;
+			if(i + run > count || n + 4 > size) return 1;
+			for(int k = 0; k < run; ++k) memcpy(c + 4 * (i + k), in + n, 4);
+			n += 4;
+			i += run;
+		}
+	}
+	return (i == count) ? 0 : 1;
+}
+
+static size_t alignUp(size_t v)
+{
+	return (v + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+static int writeBlock(FILE* out, size_t* offset, const unsigned char* data, size_t size)
+{
+	static const unsigned char zero[PACK_ALIGN] = {0};
+	size_t aligned = alignUp(*offset);
+	if(aligned > *offset && fwrite(zero, 1, aligned - *offset, out) != aligned - *offset) return 1;
+	*offset = aligned;
+	if(size && fwrite(data, 1, size, out) != size) return 1;
+	*offset += size;
+	return 0;
+}
+
+int writePack(const char* fname, const PackContent* content, int rle, size_t* written)
+{
+	unsigned char header[PACK_HEADER];
+	memset(header, 0, sizeof(header));
+	memcpy(header, "CSWPACK", 8);
+	put32(header + 8, 1);
+	put32(header + 12, PACK_REGIONS);
+
+	// offsets are known once the (encoded) sizes are, so the blocks are prepared first
+	unsigned char* encoded[PACK_REGIONS];
+	size_t encodedSize[PACK_REGIONS];
+	size_t offset = PACK_HEADER;
+	for(int i = 0; i < PACK_REGIONS; ++i)
+	{
+		encoded[i] = 0;
+		encodedSize[i] = 0;
+		int encoding = PACK_EMPTY;
+		if(content->region[i])
+		{
+			encoding = PACK_RAW;
+			encodedSize[i] = PACK_REGION_SIZE;
+			if(rle)
+			{
+				encoded[i] = (unsigned char*)malloc(PACK_REGION_SIZE + 1024);
+				encodedSize[i] = encodeRegion(content->region[i], encoded[i]);
+				encoding = PACK_RLE;
+			}
+			offset = alignUp(offset);
+		}
+		unsigned char* e = header + 64 + 24 * i;
+		put32(e, packRegionNumber(i));
+		put32(e + 4, encoding);
+		put64(e + 8, encoding == PACK_EMPTY ? 0 : offset);
+		put64(e + 16, encodedSize[i]);
+		offset += encodedSize[i];
+	}
+	for(int b = 0; b < 3; ++b)
+	{
+		offset = alignUp(offset);
+		put64(header + 16 + 16 * b, offset);
+		put64(header + 24 + 16 * b, content->blobSize[b]);
+		offset += content->blobSize[b];
+	}
+
+	int status = 1;
+	FILE* out = fopen(fname, "wb");
+	if(out)
+	{
+		size_t pos = 0;
+		status = writeBlock(out, &pos, header, PACK_HEADER);
+		for(int i = 0; !status && i < PACK_REGIONS; ++i)
+		{
+			if(!content->region[i]) continue;
+			status = writeBlock(out, &pos, encoded[i] ? encoded[i] : content->region[i], encodedSize[i]);
+		}
+		for(int b = 0; !status && b < 3; ++b)
+		{
+			status = writeBlock(out, &pos, content->blob[b], content->blobSize[b]);
+		}
+		if(fclose(out)) status = 1;
+		if(written) *written = pos;
+	}
+	for(int i = 0; i < PACK_REGIONS; ++i) free(encoded[i]);
+	return status;
+}
+
+int openPack(const char* fname, Pack* pack)
+{
+	pack->base = 0;
+	pack->size = 0;
+	pack->mapped = 0;
+	#ifdef _WIN32
+	FILE* in = fopen(fname, "rb");
+	if(!in) return 1;
+	fseek(in, 0, SEEK_END);
+	pack->size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	pack->base = (unsigned char*)malloc(pack->size);
+	if(!pack->base || fread(pack->base, 1, pack->size, in) != pack->size)
+	{
+		fclose(in);
+		free(pack->base);
+		pack->base = 0;
+		return 1;
+	}
+	fclose(in);
+	#else
+	int fd = open(fname, O_RDONLY);
+	if(fd < 0) return 1;
+	struct stat info;
+	if(fstat(fd, &info) || info.st_size < PACK_HEADER)
+	{
+		close(fd);
+		return 1;
+	}
+	pack->size = info.st_size;
+	void* p = mmap(0, pack->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) return 1;
+	pack->base = (unsigned char*)p;
+	pack->mapped = 1;
+	#endif
+	if(pack->size < PACK_HEADER || memcmp(pack->base, "CSWPACK", 8) || get32(pack->base + 8) != 1 || get32(pack->base + 12) != PACK_REGIONS)
+	{
+		closePack(pack);
+		return 1;
+	}
+	return 0;
+}
+
+void closePack(Pack* pack)
+{
+	if(!pack->base) return;
+	#ifdef _WIN32
+	free(pack->base);
+	#else
+	if(pack->mapped) munmap(pack->base, pack->size);
+	#endif
+	pack->base = 0;
+}
+
+int packRegionEncoding(const Pack* pack, int index)
+{
+	return get32(pack->base + 64 + 24 * index + 4);
+}
+
+int packRegion(const Pack* pack, int index, unsigned char* out)
+{
+	const unsigned char* e = pack->base + 64 + 24 * index;
+	int encoding = get32(e + 4);
+	unsigned long long offset = get64(e + 8);
+	unsigned long long size = get64(e + 16);
+	if(encoding == PACK_EMPTY) return 0;
+	if(offset + size > pack->size) return 0;
+	if(encoding == PACK_RAW)
+	{
+		if(size != PACK_REGION_SIZE) return 0;
+		memcpy(out, pack->base + offset, PACK_REGION_SIZE);
+		return 1;
+	}
+	return decodeRegion(pack->base + offset, size, out) ? 0 : 1;
+}
+
+const unsigned char* packBlob(const Pack* pack, int which, size_t* size)
+{
+	unsigned long long offset = get64(pack->base + 16 + 16 * which);
+	unsigned long long length = get64(pack->base + 24 + 16 * which);
+	if(offset + length > pack->size)
+	{
+		*size = 0;
+		return 0;
+	}
+	*size = length;
+	return pack->base + offset;
+}
+
+unsigned char* readWholeFile(const char* fname, size_t* size)
+{
+	FILE* in = fopen(fname, "rb");
+	if(!in) return 0;
+	fseek(in, 0, SEEK_END);
+	long length = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	unsigned char* data = length < 0 ? 0 : (unsigned char*)malloc(length + 1);
+	if(data && fread(data, 1, length, in) != (size_t)length)
+	{
+		free(data);
+		data = 0;
+	}
+	fclose(in);
+	if(!data) return 0;
+	data[length] = 0;
+	*size = length;
+	return data;
+}
+
+int packDirectory(const char* dir, const char* fname, int rle)
+{
+	char name[512];
+	PackContent content;
+	unsigned char* owned[PACK_REGIONS + 3];
+	memset(&content, 0, sizeof(content));
+	memset(owned, 0, sizeof(owned));
+
+	int status = 0;
+	for(int i = 0; i < PACK_REGIONS; ++i)
+	{
+		size_t size = 0;
+		snprintf(name, sizeof(name), "%s/Monde_%d", dir, packRegionNumber(i));
+		owned[i] = readWholeFile(name, &size);
+		if(owned[i] && size != PACK_REGION_SIZE) status = 1;
+		content.region[i] = owned[i];
+	}
+	for(int b = 0; b < 3; ++b)
+	{
+		snprintf(name, sizeof(name), "%s/%s", dir, blobName[b]);
+		owned[PACK_REGIONS + b] = readWholeFile(name, &content.blobSize[b]);
+		content.blob[b] = owned[PACK_REGIONS + b];
+		if(!content.blob[b] && b != PACK_INFO) status = 1;
+	}
+	if(!status) status = writePack(fname, &content, rle, 0);
+	for(int i = 0; i < PACK_REGIONS + 3; ++i) free(owned[i]);
+	return status;
+}
+
+int unpackToDirectory(const char* fname, const char* dir)
+{
+	Pack pack;
+	if(openPack(fname, &pack)) return 1;
+
+	struct stat info;
+	if(stat(dir, &info))
+	{
+		#ifdef _WIN32
+		int failed = mkdir(dir);
+		#else
+		int failed = mkdir(dir, 0777);
+		#endif
+		if(failed)
+		{
+			closePack(&pack);
+			return 1;
+		}
+	}
+
+	char name[512];
+	int status = 0;
+	unsigned char* region = (unsigned char*)malloc(PACK_REGION_SIZE);
+	for(int i = 0; !status && i < PACK_REGIONS; ++i)
+	{
+		snprintf(name, sizeof(name), "%s/Monde_%d", dir, packRegionNumber(i));
+		if(packRegionEncoding(&pack, i) == PACK_EMPTY)
+		{
+			if(!stat(name, &info)) remove(name);
+			continue;
+		}
+		FILE* out = packRegion(&pack, i, region) ? fopen(name, "wb") : 0;
+		if(!out || fwrite(region, 1, PACK_REGION_SIZE, out) != PACK_REGION_SIZE) status = 1;
+		if(out && fclose(out)) status = 1;
+	}
+	for(int b = 0; !status && b < 3; ++b)
+	{
+		size_t size;
+		const unsigned char* data = packBlob(&pack, b, &size);
+		if(b == PACK_INFO && size == 0) continue;
+		snprintf(name, sizeof(name), "%s/%s", dir, blobName[b]);
+		FILE* out = fopen(name, "wb");
+		if(!out || (size && fwrite(data, 1, size, out) != size)) status = 1;
+		if(out && fclose(out)) status = 1;
+	}
+	free(region);
+	closePack(&pack);
+	return status;
+}
@@ -0,0 +1,93 @@
+/* Copyright (c) 2012 Manuel Kasten
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef WORLDPACK_H_
+#define WORLDPACK_H_
+
+#include <stddef.h>
+
+/* Packed world container
+
+One file holds the 16 region files (Monde_0 .. Monde_27), Monde_Arbre,
+Monde_Doodads and csworldgen.info. All numbers are little endian.
+
+  0   char[8]  magic "CSWPACK\0"
+  8   uint32   version (1)
+  12  uint32   number of regions (16)
+  16  3 x {uint64 offset, uint64 size}         trees, doodads, info
+  64  16 x {uint32 region file number, uint32 encoding,
+            uint64 offset, uint64 stored size}
+  448 data, every block starts on a 4096 byte boundary
+
+Encoding 0 is an empty region (no Monde file), 1 the raw Monde file bytes
+(can be used straight from a mapping of the file), 2 run length coded:
+the 2 byte file prefix, then control bytes c followed by c + 1 literal
+4 byte cells if c < 128, or by one cell repeated c - 126 times otherwise.
+*/
+
+#define PACK_REGIONS 16
+#define PACK_REGION_SIZE (2 + 256 * 256 * 4)
+
+#define PACK_EMPTY 0
+#define PACK_RAW 1
+#define PACK_RLE 2
+
+#define PACK_TREES 0
+#define PACK_DOODADS 1
+#define PACK_INFO 2
+
+struct PackContent
+{
+	const unsigned char* region[PACK_REGIONS]; // Monde file bytes, 0 for an empty region
+	const unsigned char* blob[3];              // trees, doodads, info
+	size_t               blobSize[3];
+};
+
+struct Pack
+{
+	unsigned char* base;
+	size_t         size;
+	int            mapped;
+};
+
+// region file number (Monde_N) of a region index 0..15
+int packRegionNumber(int index);
+
+// writes a container, returns 0 on success
+int writePack(const char* fname, const PackContent* content, int rle, size_t* written);
+
+// maps (or reads) a container, returns 0 on success
+int openPack(const char* fname, Pack* pack);
+void closePack(Pack* pack);
+
+// encoding of a region, and its decoded Monde file bytes (PACK_REGION_SIZE) in out,
+// packRegion returns 1 if out was filled
+int packRegionEncoding(const Pack* pack, int index);
+int packRegion(const Pack* pack, int index, unsigned char* out);
+
+// trees, doodads or info, points into the container
+const unsigned char* packBlob(const Pack* pack, int which, size_t* size);
+
+// reads a whole file into a new buffer with a 0 byte after the end, returns 0
+// if it does not exist or cannot be read
+unsigned char* readWholeFile(const char* fname, size_t* size);
+
+// conversion from and to the Monde directory layout, return 0 on success
+int packDirectory(const char* dir, const char* fname, int rle);
+int unpackToDirectory(const char* fname, const char* dir);
+
+#endif /*WORLDPACK_H_*/